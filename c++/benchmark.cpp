@@ -0,0 +1,604 @@
+#include <string.h>
+#include <malloc.h>
+#include <new>
+#include "raytrace.hpp"
+#include "scene.hpp"
+
+using namespace RayTrace;
+
+//every operator new the program makes, so the scenes can show that
+//prerender itself allocates nothing
+volatile unsigned long long allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	void* ret = malloc(size ? size : 1);
+	if (!ret)
+		throw std::bad_alloc();
+	return ret;
+}
+void* operator new[](size_t size) throw(std::bad_alloc) { return operator new(size); }
+//kept out of line, or the compiler sees free() on what operator new returned
+__attribute__((noinline)) void operator delete(void* p) throw() { free(p); }
+__attribute__((noinline)) void operator delete[](void* p) throw() { free(p); }
+
+//rays leaving a point outside the scene towards random points inside it
+void shoot(std::vector<Ray>& rays, GLuint count, GLuint objects, MTRand& random)
+{
+	GLdouble side = 4 * cbrt(objects);
+	Point from(-side, -side, side);
+	rays.clear();
+	for (GLuint i = 0; i < count; i++) {
+		Point to(side * (random() - 0.5), side * (random() - 0.5), side * (random() - 0.5));
+		rays.push_back(Line(from,to).toRay(4*side));
+	}
+}
+
+template<bool linear>
+GLdouble trace(World const& world, std::vector<Ray> const& rays, std::vector<Intersection>& hits)
+{
+	hits.resize(rays.size());
+	GLdouble begin = now();
+	for (GLuint i = 0; i < rays.size(); i++)
+		hits[i] = linear ? world.intersectLinear(rays[i]) : world.intersect(rays[i]);
+	return now() - begin;
+}
+
+//closest hit over every object, either one virtual call at a time or with
+//the SIMD kernels sweeping the structure of arrays copy
+template<bool simd>
+GLdouble sweep(std::vector<Object*> const& objects, Primitives const& primitives, GLuint spheres,
+			   std::vector<Ray> const& rays, std::vector<Intersection>& hits)
+{
+	hits.resize(rays.size());
+	GLdouble begin = now();
+	for (GLuint i = 0; i < rays.size(); i++) {
+		Intersection& hit = hits[i];
+		hit = Intersection();
+		Scalar distance = rays[i].strength, t;
+		if (simd) {
+			GLint k = primitives.spheres(0, spheres, rays[i], distance, t);
+			if (k >= 0) {
+				distance = hit.length = t;
+				hit.index = k;
+			}
+			k = primitives.cubes(0, objects.size() - spheres, rays[i], inverse(rays[i].direction), distance, t);
+			if (k >= 0 && t < distance) {
+				hit.length = t;
+				hit.index = spheres + k;
+			}
+		} else
+			for (GLuint k = 0; k < objects.size(); k++) {
+				Intersection tmp = objects[k]->intersect(rays[i]);
+				if (tmp.length >= 0 && tmp.length < distance) {
+					distance = hit.length = tmp.length;
+					hit.index = k;
+				}
+			}
+	}
+	return now() - begin;
+}
+
+void kernels(GLuint count)
+{
+	MTRand random(count);
+	World world(0);
+	populate(world, count, random);
+
+	//spheres first, then cubes, matching the order of the lanes
+	std::vector<Object*> objects;
+	Primitives primitives;
+	for (GLuint i = 1; i < count; i += 2) {
+		objects.push_back(world.objects[i]);
+		primitives.push(*(Sphere*)world.objects[i]);
+	}
+	GLuint spheres = objects.size(), lanes;
+	for (GLuint i = 0; i < count; i += 2) {
+		objects.push_back(world.objects[i]);
+		primitives.push(*(Cube*)world.objects[i]);
+	}
+	primitives.align(lanes, lanes);
+
+	GLuint n = 2000000 / count;
+	std::vector<Ray> rays;
+	std::vector<Intersection> reference, hits;
+	shoot(rays, n, count, random);
+
+	GLdouble t = sweep<false>(objects, primitives, spheres, rays, reference);
+	printf("kernel,%u,scalar,%u,%f,%.0f,0\n", count, n, t, n/t);
+
+	t = sweep<true>(objects, primitives, spheres, rays, hits);
+	GLuint mismatches = 0;
+	for (GLuint i = 0; i < n; i++)
+		if (hits[i].index != reference[i].index || fabs(hits[i].length - reference[i].length) > PRECISION)
+			mismatches++;
+	printf("kernel,%u,simd%u,%u,%f,%.0f,%u\n", count, SIMD::LANES, n, t, n/t, mismatches);
+}
+
+//a pinhole view of the scene, traced ray by ray and as 2x2, 4x2 and 4x4 packets
+void packets(GLuint count, GLuint size)
+{
+	MTRand random(count);
+	World world(0);
+	populate(world, count, random);
+	world.refresh();
+
+	GLdouble side = 4 * cbrt(count);
+	Point from(-side, -side, side), at(0, 0, 0);
+	Point forward = (at - from).unitary();
+	Point right = (forward % Point(0, 1, 0)).unitary();
+	Point up = right % forward;
+
+	std::vector<Ray> rays(size * size);
+	for (GLuint j = 0; j < size; j++)
+		for (GLuint i = 0; i < size; i++) {
+			Point d = forward + (i / (GLdouble)size - 0.5) * right + (j / (GLdouble)size - 0.5) * up;
+			rays[j*size + i] = Ray(from, d.unitary(), 4*side);
+		}
+
+	std::vector<Intersection> reference(rays.size()), hits(rays.size());
+	GLdouble t = now();
+	for (GLuint i = 0; i < rays.size(); i++)
+		reference[i] = world.intersect(rays[i]);
+	t = now() - t;
+	printf("packet,%u,single,%u,%f,%.0f,0\n", count, (GLuint)rays.size(), t, rays.size()/t);
+
+	const GLuint widths[] = { 2, 4, 4 }, heights[] = { 2, 2, 4 };
+	for (GLuint w = 0; w < 3; w++) {
+		Packet packet;
+		t = now();
+		for (GLuint j = 0; j < size; j += heights[w])
+			for (GLuint i = 0; i < size; i += widths[w]) {
+				packet.clear();
+				for (GLuint b = 0; b < heights[w]; b++)
+					for (GLuint a = 0; a < widths[w]; a++)
+						packet.add(rays[(j+b)*size + i+a]);
+				world.intersect(packet);
+				for (GLuint b = 0, p = 0; b < heights[w]; b++)
+					for (GLuint a = 0; a < widths[w]; a++)
+						hits[(j+b)*size + i+a] = packet.hits[p++];
+			}
+		t = now() - t;
+
+		GLuint mismatches = 0;
+		for (GLuint i = 0; i < rays.size(); i++)
+			if (hits[i].length != reference[i].length || hits[i].index != reference[i].index)
+				mismatches++;
+		printf("packet,%u,%ux%u,%u,%f,%.0f,%u\n", count, widths[w], heights[w],
+			   (GLuint)rays.size(), t, rays.size()/t, mismatches);
+	}
+}
+
+//the acceleration structure and kernels against the brute force paths
+void intersections(GLuint limit)
+{
+	const GLuint counts[] = { 10, 100, 1000, 10000, 50000 };
+
+	printf("test,objects,path,rays,seconds,rays_per_second,mismatches\n");
+	kernels(16);
+	kernels(256);
+	packets(1000, 256);
+	packets(10000, 256);
+	for (GLuint c = 0; c < sizeof(counts)/sizeof(*counts); c++) {
+		if (counts[c] > limit)
+			break;
+
+		MTRand random(counts[c]);
+		World world(0);
+		populate(world, counts[c], random);
+
+		GLdouble build = now();
+		world.refresh();
+		build = now() - build;
+
+		//keep the brute force path around a second per scene
+		GLuint n = 2000000 / counts[c];
+		if (n < 200)
+			n = 200;
+
+		std::vector<Ray> rays;
+		std::vector<Intersection> reference, hits;
+		shoot(rays, n, counts[c], random);
+
+		GLdouble t = trace<true>(world, rays, reference);
+		printf("world,%u,linear,%u,%f,%.0f,0\n", counts[c], n, t, n/t);
+
+		t = trace<false>(world, rays, hits);
+		GLuint mismatches = 0;
+		for (GLuint i = 0; i < n; i++)
+			if (hits[i].length != reference[i].length || hits[i].index != reference[i].index)
+				mismatches++;
+		printf("world,%u,bvh,%u,%f,%.0f,%u\n", counts[c], n, t, n/t, mismatches);
+		fprintf(stderr, "%u objects: %u nodes built in %fs\n", counts[c], (GLuint)world.bvh.nodes.size(), build);
+	}
+}
+
+//one full render of a scene per thread count, the first one being the
+//single threaded baseline the others are scaled against
+template<GLuint AA, GLuint D, GLuint S, GLuint I>
+void render(const char* scene, const char* config, World const& world, Camera const& camera,
+			GLint width, GLint height, bool adaptive = false, bool wavefront = false)
+{
+	RayData<AA,D,S,I> data;
+	data.camera = camera;
+	data.adaptive = adaptive;
+	data.wavefront = wavefront;
+	data.resize(width, height);
+
+	std::vector<GLuint> counts;
+	for (GLuint t = 1; t < threads(); t *= 2)
+		counts.push_back(t);
+	counts.push_back(threads());
+
+	GLdouble single = 0;
+	for (GLuint c = 0; c < counts.size(); c++) {
+		omp_set_num_threads(counts[c]);
+		data.resetStatistics();
+
+		unsigned long long allocated = allocations;
+		GLdouble t = now();
+		prerender(data, world);
+		t = now() - t;
+		allocated = allocations - allocated;
+		if (c == 0)
+			single = t;
+
+		//idle is the time threads spent waiting for the slowest one
+		GLdouble busy = 0, idle = 0;
+		for (GLuint q = 0; q < data.scheduler.queues.size(); q++) {
+			busy += data.scheduler.queues[q].busy;
+			idle += data.scheduler.queues[q].idle;
+		}
+
+		Statistics s = data.total();
+		printf("%s,%s,%d,%d,%u,%f,%llu,%llu,%llu,%.0f,%.0f,%.0f,%.0f,%.2f,%f,%f,%llu,%.2f\n",
+			   scene, config, width, height, counts[c], t, s.primary, s.secondary, s.shadow,
+			   s.primary/t, s.secondary/t, s.shadow/t, (s.primary + s.secondary + s.shadow)/t, single/t,
+			   busy, idle, allocated, data.samplesPerPixel);
+		fflush(stdout);
+	}
+}
+
+//every scene under a cheap preview, antialiased depth of field (taking
+//every sample or only those on edges), soft shadows and, where the scene
+//is small enough, interreflections; the preview, shadows and
+//interreflections again as wavefront renders
+void scene(const char* name, World const& world, Camera const& camera)
+{
+	//the hierarchy is built here rather than by the first render
+	world.refresh();
+	render<1,1,1,0>(name, "preview", world, camera, 320, 240);
+	render<4,2,1,0>(name, "antialias", world, camera, 160, 120);
+	render<4,2,1,0>(name, "adaptive", world, camera, 160, 120, true);
+	render<1,1,1,0>(name, "wavefront", world, camera, 320, 240, false, true);
+	render<1,1,8,0>(name, "shadows", world, camera, 160, 120);
+	render<1,1,8,0>(name, "wavefront-shadows", world, camera, 160, 120, false, true);
+	if (world.objects.size() <= 1000) {
+		render<1,1,1,1>(name, "interreflections", world, camera, 16, 12);
+		render<1,1,1,1>(name, "wavefront-interreflections", world, camera, 16, 12, false, true);
+	}
+}
+
+void header()
+{
+	printf("scene,config,width,height,threads,seconds,primary,secondary,shadow,"
+		   "primary_per_second,secondary_per_second,shadow_per_second,rays_per_second,speedup,busy,idle,allocations,samples_per_pixel\n");
+}
+
+void scenes(GLuint limit)
+{
+	const GLuint counts[] = { 1000, 10000, 100000 };
+
+	header();
+	{
+		MTRand random(1);
+		World world(0);
+		Camera* camera = demo(world, random);
+		scene("cubes", world, *camera);
+		delete camera;
+	}
+	{
+		World world(0);
+		Camera* camera = spheres(world);
+		scene("spheres", world, *camera);
+		delete camera;
+	}
+	{
+		MTRand random(1);
+		World world(0);
+		Camera* camera = sculpture(world, 100, random);
+		scene("sculpture", world, *camera);
+		delete camera;
+	}
+	for (GLuint c = 0; c < sizeof(counts)/sizeof(*counts) && counts[c] <= limit; c++) {
+		MTRand random(counts[c]);
+		World world(0);
+		Camera* camera = procedural(world, counts[c], random);
+		char name[32];
+		sprintf(name, "procedural%u", counts[c]);
+		scene(name, world, *camera);
+		delete camera;
+	}
+}
+
+//every channel of the demo scene drawn the fixed way, on one thread or
+//in Hilbert order, or ray by ray in 4x4 or 2x2 packets, adaptively
+//(refining every pixel when path is "refined"), as a wavefront or
+//progressively until every offset met every lens sample
+template<GLuint AA, GLuint D, GLuint S, GLuint I>
+void frame(World const& world, Camera const& camera, const char* path, std::vector<GLfloat>& ret)
+{
+	RayData<AA,D,S,I> data;
+	data.camera = camera;
+	data.packet = !strcmp(path, "packets") ? 16 : !strcmp(path, "packets4") ? 4 : 1;
+	data.order = !strcmp(path, "hilbert") ? Scheduler::hilbert : data.order;
+	data.adaptive = !strcmp(path, "adaptive") || !strcmp(path, "refined");
+	data.threshold = !strcmp(path, "refined") ? -1 : data.threshold;
+	data.wavefront = !strcmp(path, "wavefront");
+	data.progressive = !strcmp(path, "progressive");
+	data.samples = 9 * D;
+	data.resize(64, 48);
+	omp_set_num_threads(!strcmp(path, "single") ? 1 : threads());
+	do
+		prerender(data, world);
+	while (data.progressive && data.changed);
+	omp_set_num_threads(threads());
+
+	ret.clear();
+	for (GLint j = 0; j < data.buffer.height; j++)
+		for (GLint i = 0; i < data.buffer.width; i++) {
+			Color c = data.buffer(i, j);
+			ret.push_back(c.red);
+			ret.push_back(c.green);
+			ret.push_back(c.blue);
+		}
+}
+
+//every path against the fixed one. Light samples are seeded by pixel and
+//sample and primary rays built in one place, so the thread count, the
+//tile order, packets, adaptive renders refining every pixel and
+//wavefronts must all agree pixel by pixel.
+//Adaptive renders keep the center sample off edges, and progressive ones
+//step their rays along a row and seed their samples by pass, so those
+//only have to come out as bright. Progressive ones go through all nine
+//offsets, so they only converge to the fixed frame at AA=9.
+template<GLuint AA, GLuint D, GLuint S, GLuint I>
+GLuint image(const char* config, World const& world, Camera const& camera)
+{
+	const char* paths[] = { "single", "hilbert", "packets", "packets4", "refined", "adaptive",
+							"wavefront", "progressive" };
+	const bool exact[] = { true, true, true, true, true, false, true, false };
+	const GLdouble tolerance = 1e-4;
+
+	GLuint failures = 0;
+	std::vector<GLfloat> reference, pixels;
+	frame<AA,D,S,I>(world, camera, "fixed", reference);
+	for (GLuint p = 0; p < sizeof(paths)/sizeof(*paths); p++) {
+		if (AA != 9 && !strcmp(paths[p], "progressive"))
+			continue;
+		frame<AA,D,S,I>(world, camera, paths[p], pixels);
+
+		GLdouble mean = 0, expected = 0, worst = 0;
+		GLuint differing = 0;
+		for (GLuint i = 0; i < pixels.size(); i += 3) {
+			GLdouble d = 0;
+			for (GLuint c = i; c < i + 3; c++) {
+				mean += pixels[c];
+				expected += reference[c];
+				d = std::max(d, fabs((GLdouble)pixels[c] - reference[c]));
+			}
+			worst = std::max(worst, d);
+			differing += d > tolerance;
+		}
+		mean /= pixels.size();
+		expected /= pixels.size();
+
+		bool ok = exact[p] ? differing == 0 : fabs(mean - expected) <= 0.02 * expected;
+		printf("image,%s,%s,%f,%f,%f,%u,%s\n", config, paths[p], mean, expected, worst, differing,
+			   ok ? "ok" : "FAILED");
+		failures += !ok;
+	}
+	return failures;
+}
+
+//the demo scene under several antialias and lens settings. Returns how
+//many paths drew a frame other than the fixed one.
+GLuint images()
+{
+	MTRand random(1);
+	World world(0);
+	Camera* camera = demo(world, random);
+	world.refresh();
+
+	printf("test,config,path,mean,reference,max_difference,differing_pixels,result\n");
+	GLuint failures = image<1,1,1,0>("aa1", world, *camera) +
+					  image<4,1,1,0>("aa4", world, *camera) +
+					  image<9,1,1,0>("aa9", world, *camera) +
+					  image<4,2,1,0>("aa4-lens2", world, *camera) +
+					  image<9,2,1,0>("aa9-lens2", world, *camera);
+	delete camera;
+	return failures;
+}
+
+//a thousand objects under more and more small lights, most of which only
+//light a corner of the volume
+void lights(GLuint limit)
+{
+	const GLuint counts[] = { 2, 16, 64, 256, 1024 };
+
+	header();
+	for (GLuint c = 0; c < sizeof(counts)/sizeof(*counts) && counts[c] <= limit; c++) {
+		MTRand random(1000);
+		World world(0);
+		Camera* camera = rig(world, 1000, counts[c], random);
+		world.refresh();
+		char name[32];
+		sprintf(name, "lights%u", counts[c]);
+		render<1,1,1,0>(name, "preview", world, *camera, 160, 120);
+		render<1,1,4,0>(name, "shadows", world, *camera, 160, 120);
+		delete camera;
+	}
+}
+
+//a blob of rings² triangles written as OBJ, then loaded by parsing it and
+//by mapping its cache. Rays towards the blob must hit the same triangles
+//at the same distances in both.
+void meshes(GLuint limit)
+{
+	const GLuint rings[] = { 50, 158, 500 };
+	const char* path = "/tmp/raytrace-blob.obj";
+	const char* cache = "/tmp/raytrace-blob.obj.mesh";
+
+	printf("test,triangles,path,seconds,mismatches\n");
+	for (GLuint r = 0; r < sizeof(rings)/sizeof(*rings) && 4*rings[r]*rings[r] <= limit; r++) {
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> triangles;
+		blob(vertices, triangles, rings[r]);
+		GLuint count = triangles.size()/3;
+
+		FILE* f = fopen(path, "w");
+		if (!f) {
+			perror(path);
+			exit(1);
+		}
+		for (GLuint i = 0; i < vertices.size(); i += 3)
+			fprintf(f, "v %f %f %f\n", vertices[i], vertices[i+1], vertices[i+2]);
+		for (GLuint i = 0; i < triangles.size(); i += 3)
+			fprintf(f, "f %u %u %u\n", triangles[i] + 1, triangles[i+1] + 1, triangles[i+2] + 1);
+		fclose(f);
+
+		GLdouble t = now();
+		TriangleMesh built(vertices, triangles);
+		printf("mesh,%u,build,%f,0\n", count, now() - t);
+
+		t = now();
+		TriangleMesh* parsed = TriangleMesh::obj(path);
+		if (!parsed) {
+			fprintf(stderr, "%s: can't load mesh\n", path);
+			exit(1);
+		}
+		printf("mesh,%u,obj,%f,0\n", count, now() - t);
+
+		t = now();
+		if (!parsed->save(cache)) {
+			perror(cache);
+			exit(1);
+		}
+		printf("mesh,%u,save,%f,0\n", count, now() - t);
+
+		t = now();
+		TriangleMesh* mapped = TriangleMesh::map(cache);
+		if (!mapped) {
+			fprintf(stderr, "%s: can't map mesh\n", cache);
+			exit(1);
+		}
+		printf("mesh,%u,map,%f,0\n", count, now() - t);
+
+		//the first rays also page the mapping in
+		MTRand random(count);
+		GLuint n = 100000, mismatches = 0;
+		GLdouble traced[2] = { 0, 0 };
+		for (GLuint i = 0; i < n; i++) {
+			Point d(random() - 0.5, random() - 0.5, random() - 0.5);
+			d = d.unitary();
+			Point o = 3 * Point(random() - 0.5, random() - 0.5, random() - 0.5) - 3 * d;
+			Ray ray(o, d, 10);
+
+			t = now();
+			Intersection a = parsed->intersect(ray);
+			traced[0] += now() - t;
+			t = now();
+			Intersection b = mapped->intersect(ray);
+			traced[1] += now() - t;
+			if (a.length != b.length || (a.length >= 0 && a.normal * b.normal < 1 - PRECISION))
+				mismatches++;
+		}
+		printf("mesh,%u,trace-obj,%f,0\n", count, traced[0]);
+		printf("mesh,%u,trace-map,%f,%u\n", count, traced[1], mismatches);
+		fflush(stdout);
+
+		delete parsed;
+		delete mapped;
+		remove(path);
+		remove(cache);
+	}
+}
+
+//the tiled cube field as separate cubes and as instances of one tile: the
+//bytes the world and its hierarchy take, the time to build them and a
+//preview of each, whose pixels should agree
+void instances(GLuint limit)
+{
+	const GLuint sides[] = { 30, 300, 999 };
+
+	printf("test,cubes,path,objects,bytes,build_seconds,render_seconds,mismatches\n");
+	for (GLuint c = 0; c < sizeof(sides)/sizeof(*sides) && sides[c]*sides[c] <= limit; c++) {
+		std::vector<GLubyte> reference;
+		for (GLuint instanced = 0; instanced < 2; instanced++) {
+			MTRand random(1);
+			size_t bytes = mallinfo2().uordblks;
+			GLdouble build = now();
+			World* world = new World(0);
+			Camera* camera = field(*world, sides[c], instanced, random);
+			world->refresh();
+			build = now() - build;
+			bytes = mallinfo2().uordblks - bytes;
+
+			RayData<1,1,1,0> data;
+			data.camera = *camera;
+			data.resize(320, 240);
+			GLdouble t = now();
+			prerender(data, *world);
+			t = now() - t;
+
+			data.pack();
+			GLubyte const* pixels = data.buffer.packed();
+			GLuint mismatches = 0;
+			if (instanced) {
+				for (GLuint i = 0; i < reference.size(); i++)
+					if (reference[i] != pixels[i])
+						mismatches++;
+			} else
+				reference.assign(pixels, pixels + 3*320*240);
+
+			printf("instances,%u,%s,%u,%lu,%f,%f,%u\n", sides[c]*sides[c], instanced ? "instanced" : "flat",
+				   (GLuint)world->objects.size(), (unsigned long)bytes, build, t, mismatches);
+			fflush(stdout);
+			delete camera;
+			delete world;
+		}
+	}
+}
+
+void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [scenes|intersections|lights|meshes|instances|images] [max objects, lights or triangles]\n", name);
+	exit(1);
+}
+
+//CSV on stdout: the render suite by default, the intersection one, the
+//many lights one, the mesh loading one, the instancing one or the image
+//checks, which also exit non-zero when one fails
+int main(int argc, char** argv)
+{
+	const char* suite = argc > 1 ? argv[1] : "scenes";
+	GLuint limit = argc > 2 ? atoi(argv[2]) : 100000;
+
+	if (!strcmp(suite, "scenes"))
+		scenes(limit);
+	else if (!strcmp(suite, "intersections"))
+		intersections(limit);
+	else if (!strcmp(suite, "lights"))
+		lights(limit);
+	else if (!strcmp(suite, "meshes"))
+		meshes(limit);
+	else if (!strcmp(suite, "instances"))
+		instances(limit);
+	else if (!strcmp(suite, "images"))
+		return images() ? 1 : 0;
+	else
+		usage(argv[0]);
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include <string.h>
+#include "raytrace.hpp"
+#include "scene.hpp"
+
+using namespace RayTrace;
+
+World myWorld(0);
+Camera* myCamera;
+
+//binary PPM, top row first: the same picture render() draws bottom-up
+template<GLuint AA, GLuint D, GLuint S, GLuint I>
+bool write(RayData<AA,D,S,I>& data, const char* name)
+{
+	FILE* file = fopen(name, "wb");
+	if (!file)
+		return false;
+
+	data.pack();
+	fprintf(file, "P6\n%d %d\n255\n", data.viewport[2], data.viewport[3]);
+	for (GLint j = data.viewport[3] - 1; j >= 0; j--)
+		fwrite(data.buffer.packed() + 3 * j * data.viewport[2], 1, 3 * data.viewport[2], file);
+	return fclose(file) == 0;
+}
+
+//what the command line sets besides the scene
+struct Options
+{
+	GLint width, height;
+	GLuint packet;
+	GLint tile;
+	Scheduler::Order order;
+	GLuint wave;
+	const char* output;
+};
+
+template<GLuint AA, GLuint D, GLuint S, GLuint I>
+int render(Options const& options)
+{
+	RayData<AA,D,S,I> data;
+	data.camera = *myCamera;
+	data.packet = options.packet;
+	data.tile = options.tile;
+	data.order = options.order;
+	//a wave size traces the frame as a wavefront, that many rays a batch
+	data.wavefront = options.wave > 0;
+	if (options.wave > 0)
+		data.wave = options.wave;
+	data.resize(options.width, options.height);
+
+	GLdouble begin = now();
+	prerender(data, myWorld);
+	printf("trace %fs\n", now() - begin);
+	for (GLuint t = 0; t < data.scheduler.queues.size(); t++) {
+		Scheduler::Queue const& q = data.scheduler.queues[t];
+		printf("thread %u: %u tiles (%u stolen), busy %fs, idle %fs\n", t, q.tiles, q.stolen, q.busy, q.idle);
+	}
+
+	if (!write(data, options.output)) {
+		perror(options.output);
+		return 1;
+	}
+	return 0;
+}
+
+void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-i scene] [-c compiled scene] [-w width] [-h height] [-s seed] [-p packet] [-t tile] [-m rows|morton|hilbert] [-v wave] [-k 0|1] [-o image.ppm]\n", name);
+	exit(1);
+}
+
+//renders the scene file given, or the demo, to a PPM. With -c the scene
+//is only compiled to its binary form. -k 1 writes the scene's OBJ meshes'
+//caches next to them.
+int main(int argc, char** argv)
+{
+	Options options = { 0, 0, 1, 16, Scheduler::rows, 0, "render.ppm" };
+	GLuint seed = 0;
+	const char* scene = 0;
+	const char* compiled = 0;
+	bool cache = false;
+
+	for (GLint i = 1; i < argc; i++) {
+		if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+			usage(argv[0]);
+		switch (argv[i++][1]) {
+			case 'i': scene = argv[i]; break;
+			case 'c': compiled = argv[i]; break;
+			case 'w': options.width = atoi(argv[i]); break;
+			case 'h': options.height = atoi(argv[i]); break;
+			case 's': seed = atoi(argv[i]); break;
+			case 'p': options.packet = atoi(argv[i]); break;
+			case 't': options.tile = atoi(argv[i]); break;
+			case 'm':
+				if (!strcmp(argv[i], "rows"))
+					options.order = Scheduler::rows;
+				else if (!strcmp(argv[i], "morton"))
+					options.order = Scheduler::morton;
+				else if (!strcmp(argv[i], "hilbert"))
+					options.order = Scheduler::hilbert;
+				else
+					usage(argv[0]);
+				break;
+			case 'v': options.wave = atoi(argv[i]); break;
+			case 'o': options.output = argv[i]; break;
+			case 'k': cache = atoi(argv[i]) != 0; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (options.tile <= 0 || (compiled && !scene))
+		usage(argv[0]);
+
+	GLuint quality[4] = { 1, 1, 1, 0 };
+	if (scene) {
+		SceneFile file;
+		GLdouble begin = now();
+		if (!file.read(scene))
+			return 1;
+		printf("read %fs\n", now() - begin);
+		if (compiled) {
+			if (!file.write(compiled)) {
+				perror(compiled);
+				return 1;
+			}
+			return 0;
+		}
+		if (!(myCamera = file.build(myWorld, cache)))
+			return 1;
+		//the command line wins over the file
+		if (options.width == 0)
+			options.width = file.width;
+		if (options.height == 0)
+			options.height = file.height;
+		memcpy(quality, file.quality, sizeof(quality));
+	} else {
+		//without a seed the scene is as random as prt's
+		MTRand random;
+		if (seed > 0)
+			random.seed(seed);
+		myCamera = demo(myWorld, random);
+	}
+	if (options.width == 0)
+		options.width = 32;
+	if (options.height == 0)
+		options.height = 24;
+	if (options.width < 0 || options.height < 0)
+		usage(argv[0]);
+
+	//the qualities bench renders are built in, anything else needs its own
+	//RayData instance here
+	GLuint q = quality[0] << 24 | quality[1] << 16 | quality[2] << 8 | quality[3];
+	switch (q) {
+		case 0x01010100: return render<1,1,1,0>(options);
+		case 0x04020100: return render<4,2,1,0>(options);
+		case 0x01010800: return render<1,1,8,0>(options);
+		case 0x01010101: return render<1,1,1,1>(options);
+		default:
+			fprintf(stderr, "%s: quality %u %u %u %u isn't built in (1 1 1 0, 4 2 1 0, 1 1 8 0 or 1 1 1 1)\n",
+					argv[0], quality[0], quality[1], quality[2], quality[3]);
+			return 1;
+	}
+}
@@ -1,6 +1,6 @@
 #include <GL/glut.h>
-#include <ctime>
 #include "raytrace.hpp"
+#include "scene.hpp"
 
 using namespace RayTrace;
 
@@ -9,13 +9,20 @@ Camera* myCamera;
 RayData<1,1,1,0> myRay;
 
 void render() {
-	static time_t begin, end;
-	
-	time(&begin);
 	render(myRay,myWorld);
-	time(&end);
 
-	printf("%.f\n", difftime(end,begin));
+	if (myRay.progressive)
+		printf("pass %u/%u ", myRay.passes, myRay.samples);
+	printf("trace %fs display %fs\n", myRay.traceTime, myRay.displayTime);
+	#ifdef RAYTRACE_CACHE
+	RayCache::Counters c = myRay.cache.total();
+	printf("cache hits %llu misses %llu insertions %llu evictions %llu\n",
+		   c.hits, c.misses, c.insertions, c.evictions);
+	#endif
+
+	//progressive renders keep refining until their last pass
+	if (myRay.changed)
+		glutPostRedisplay();
 }
 void reshape(int w, int h)
 {
@@ -86,13 +93,29 @@ void keyboard (unsigned char key, int x, int y)
 				myRay.changeCamera(*myCamera);
 				glutPostRedisplay();
 				break;
+			case 'p':
+				myRay.packet = myRay.packet == 1 ? 4 : myRay.packet == 16 ? 1 : 2*myRay.packet;
+				myRay.changed = true;
+				glutPostRedisplay();
+				break;
+			case 'v':
+				myRay.wavefront = !myRay.wavefront;
+				myRay.changed = true;
+				glutPostRedisplay();
+				break;
+			case 'g':
+				myRay.progressive = !myRay.progressive;
+				myRay.passes = 0;
+				myRay.changed = true;
+				glutPostRedisplay();
+				break;
 			default:
 				break;
 		}
 	
 	char buffer[256];
 
-	sprintf(buffer, "Camera (%f, %f, %f); lens:%f Rate: %f", myCamera->lookFrom.x, myCamera->lookFrom.y, myCamera->lookFrom.z, myCamera->lensHeight, taxa);
+	sprintf(buffer, "Camera (%f, %f, %f); lens:%f Rate: %f Packet: %u%s%s", myCamera->lookFrom.x, myCamera->lookFrom.y, myCamera->lookFrom.z, myCamera->lensHeight, taxa, myRay.packet, myRay.progressive ? " Progressive" : "", myRay.wavefront ? " Wavefront" : "");
 
 	glutSetWindowTitle(buffer);
 }
@@ -112,9 +135,36 @@ void init (int argc, char** argv, GLint x, GLint y) {
 
 int main(int argc, char** argv)
 {
+	//an optional seed reproduces a scene, e.g. one rendered by hrt, and
+	//anything else is a scene file to render instead of the demo
+	MTRand random;
+	SceneFile file;
+	bool scene = argc > 1 && argv[1][strspn(argv[1], "0123456789")];
+	if (argc > 1 && atoi(argv[1]) > 0)
+		random.seed(atoi(argv[1]));
+	#ifdef RAYTRACE_CACHE
+	//and a second argument caps the cache, in megabytes
+	if (argc > 2 && atoi(argv[2]) > 0)
+		myRay.cache.resize((size_t)atoi(argv[2]) << 20);
+	#endif
+
 	//myCamera = new Camera(Point(0,0,0),Point(-30,-40,32),Point(0,1,0),20,3000,30,1);
-	myCamera = new Camera(Point(0,0,0),Point(10,-20,10),Point(0,1,0),30,3000,7,0.3);
+	if (!scene) {
+		myCamera = demo(myWorld, random);
+		file.width = 32;
+		file.height = 24;
+	} else if (!file.read(argv[1]) || !(myCamera = file.build(myWorld)))
+		return 1;
 	myRay.changeCamera(*myCamera);
+	//more than one sample per pixel is only had by refining progressively,
+	//a pass per antialias offset and light sample. One lens sample and no
+	//interreflections are all myRay is built for.
+	if (file.quality[1] > 1 || file.quality[3] > 0)
+		fprintf(stderr, "%s: quality %u %u %u %u drawn with 1 depth ray and no interreflections\n",
+				argv[1], file.quality[0], file.quality[1], file.quality[2], file.quality[3]);
+	myRay.samples = file.quality[0]*file.quality[2];
+	if (myRay.samples > 1)
+		myRay.progressive = true;
 	
 	/*myWorld.add(new Sphere(Point( 3, 3, 3),Point(0,1,0), 2),Material(0, 0.5,50,0.4,0.1,Color(1,1,1)));
 	myWorld.add(new Sphere(Point( 3, 3,-3),Point(0,1,0), 2),Material(0, 0.5,50,0.4,0.1,Color(1,1,0)));
@@ -127,20 +177,12 @@ int main(int argc, char** argv)
 
 	myWorld.add(new Cube(Point(0,0,0),Point(0,1,0), 6),Material(0, 0.5,100,0.4,0.1,Color(0,0,1)));*/
 
-	MTRand random;
-	for (double i = -1; i < 2; i++)
-		for (double j = -1; j < 2; j++)
-			myWorld.add(new Cube(Point(2*i,0,2*j),Point(0,1,0), random() * 2),Material(0.4,0.5,0,100,0.1,Color(random(),random(),random())));
-
 //	myWorld.add(new Cube(Point(0,80,0),Point(0,1,0), 160),Material(Color(0.3,0.4,0.5),Color(0.5,0.4,0.3),0,100,0.1,Color(1,0.5,0.5)));
 //	myWorld.add(new Cube(Point(0,-1,0),Point(0,1,0), 1),Material(Color(0.5,0.4,0.3),Color(0.3,0.4,0.5),0,100,0.1,Color(0,0,1)));
 
 //	myWorld.add(new Sphere(Point(0,0,0),Point(0,1,0), 1),Material(0, 0.5,50,0.5,0.8,Color(1,1,1)));
 //	myWorld.add(new Sphere(Point(-5,-6,10),Point(0,1,0), 0.5),Material(0, 0.5,50,0.5,0.8,Color(0,1,0)));
 
-	myWorld.add(Light(Point(5,-5,10),Color(1,1,1),400, 5));
-	myWorld.add(Light(Point(-5,-5,-10),Color(1,1,1),250, 3));
-
-	init (argc, argv, 32, 24);
+	init (argc, argv, file.width, file.height);
 	return 0;
 }
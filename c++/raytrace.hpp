@@ -1,20 +1,56 @@
 #ifndef RAYTRACE_H
 #define RAYTRACE_H
 
+#ifdef RAYTRACE_HEADLESS
+typedef double GLdouble;
+typedef float GLfloat;
+typedef int GLint;
+typedef unsigned int GLuint;
+typedef unsigned char GLubyte;
+#else
 #include "GL/gl.h"
 #include "GL/glu.h"
+#endif
 #include <math.h>
 #include <vector>
+#include <algorithm>
+#include <new>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include "MersenneTwister.h"
 
 #ifndef RAYTRACE_NONPARALLEL
 #include <omp.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace RayTrace {
+	//the scalar of the math core: points, colors, rays, hits, scene data
+	//and the SIMD lanes are all single precision in a RAYTRACE_FLOAT build,
+	//which doubles the lanes of the kernels (about twice the sphere rate of
+	//bench intersections). Against double on the bench scenes, 99.2% (spheres,
+	//grazing reflections and silhouettes) to 99.9% (cubes) of the 8 bit
+	//pixels are within one level of each other. Camera matrices and timings
+	//stay double.
+	#ifdef RAYTRACE_FLOAT
+	typedef GLfloat Scalar;
+	#else
+	typedef GLdouble Scalar;
+	#endif
+
 	struct Point;
 	struct Ray;
 	struct Color;
@@ -27,10 +63,10 @@ namespace RayTrace {
 	Color shade(RayTracer const& rt, World const& world, Ray& ray, Intersection const& result);
 }
 
-inline GLdouble				operator*(RayTrace::Point a, RayTrace::Point b);
-inline RayTrace::Point		operator*(GLdouble a, RayTrace::Point b);
-inline RayTrace::Point		operator*(RayTrace::Point a, GLdouble b);
-inline RayTrace::Point		operator/(RayTrace::Point a, GLdouble b);
+inline RayTrace::Scalar		operator*(RayTrace::Point a, RayTrace::Point b);
+inline RayTrace::Point		operator*(RayTrace::Scalar a, RayTrace::Point b);
+inline RayTrace::Point		operator*(RayTrace::Point a, RayTrace::Scalar b);
+inline RayTrace::Point		operator/(RayTrace::Point a, RayTrace::Scalar b);
 inline RayTrace::Point		operator%(RayTrace::Point a, RayTrace::Point b);
 inline RayTrace::Point		operator+(RayTrace::Point a, RayTrace::Point b);
 inline RayTrace::Point		operator-(RayTrace::Point a, RayTrace::Point b);
@@ -40,8 +76,8 @@ inline bool operator!=(RayTrace::Point a, RayTrace::Point b);
 
 inline RayTrace::Point&	operator+=(RayTrace::Point& a, RayTrace::Point b);
 inline RayTrace::Point&	operator-=(RayTrace::Point& a, RayTrace::Point b);
-inline RayTrace::Point&	operator*=(RayTrace::Point& a, GLdouble b);
-inline RayTrace::Point&	operator/=(RayTrace::Point& a, GLdouble b);
+inline RayTrace::Point&	operator*=(RayTrace::Point& a, RayTrace::Scalar b);
+inline RayTrace::Point&	operator/=(RayTrace::Point& a, RayTrace::Scalar b);
 inline RayTrace::Point&	operator%=(RayTrace::Point& a, RayTrace::Point b);
 
 
@@ -49,77 +85,91 @@ inline RayTrace::Point&	operator%=(RayTrace::Point& a, RayTrace::Point b);
 inline RayTrace::Color		operator+(RayTrace::Color a, RayTrace::Color b);
 inline RayTrace::Color		operator-(RayTrace::Color a, RayTrace::Color b);
 inline RayTrace::Color		operator*(RayTrace::Color a, RayTrace::Color b);
-inline RayTrace::Color		operator*(GLdouble a, RayTrace::Color b);
-inline RayTrace::Color		operator*(RayTrace::Color a, GLdouble b);
+inline RayTrace::Color		operator*(RayTrace::Scalar a, RayTrace::Color b);
+inline RayTrace::Color		operator*(RayTrace::Color a, RayTrace::Scalar b);
 inline RayTrace::Color		operator/(RayTrace::Color a, RayTrace::Color b);
 
 inline bool operator==(RayTrace::Color a, RayTrace::Color b);
 inline bool operator!=(RayTrace::Color a, RayTrace::Color b);
 
 inline RayTrace::Color&	operator+=(RayTrace::Color& a, RayTrace::Color b);
-inline RayTrace::Color&	operator*=(RayTrace::Color& a, GLdouble b);
+inline RayTrace::Color&	operator*=(RayTrace::Color& a, RayTrace::Scalar b);
 
 namespace RayTrace {
 
-	const GLdouble PRECISION = 0.0000001;
-	namespace Sampling {
-		enum format {
-			square,
-			circle,
-			hexagon
-		};
+	//PRECISION is how far apart two points or distances must be to differ.
+	//Hit points are only good to a few float ulps of the scene's size, so a
+	//float build needs a much coarser one to keep rays off their own surface.
+	#ifdef RAYTRACE_FLOAT
+	const Scalar PRECISION = 0.001;
 
-		GLdouble** getPoints(format shape, GLuint count, MTRand& random)
-		{
-			GLdouble** ret = new GLdouble*[2];
-	
-			ret[0] = new GLdouble[count];
-			ret[1] = new GLdouble[count];
+	inline Scalar minimum(Scalar a, Scalar b) { return fminf(a, b); }
+	inline Scalar maximum(Scalar a, Scalar b) { return fmaxf(a, b); }
+	#else
+	const Scalar PRECISION = 0.0000001;
 
-			switch(shape)
-			{
-				case circle:
-					for(GLuint i = 0; i < count; i++) {
-						#ifndef RAYTRACE_NONPARALLEL
-						#pragma omp critical
-						#endif
-						{
-							ret[0][i] = 6.28318530718 * random.rand();
-							ret[1][i] = random.rand() + random.rand();
-						}
-						if (ret[1][i] > 1)
-							ret[1][i] = 2 - ret[1][i];
-					}
-					for(GLuint i = 0; i < count; i++) {
-						GLdouble a = ret[0][i];
-						ret[0][i] = ret[1][i]*cos(a);
-						ret[1][i] *= sin(a);
-					}
-				default:
-					break;
-			}
+	inline Scalar minimum(Scalar a, Scalar b) { return fmin(a, b); }
+	inline Scalar maximum(Scalar a, Scalar b) { return fmax(a, b); }
+	#endif
 
-			return ret;
+	//splitmix64 finalizer: nearby inputs give unrelated outputs
+	inline unsigned long long mix(unsigned long long z)
+	{
+		z += 0x9e3779b97f4a7c15ULL;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	//a small generator each thread owns. It is reseeded for every sample
+	//from the pixel and the sample number, so pictures don't depend on which
+	//thread traced what, and no thread ever waits for another one.
+	struct Random
+	{
+		unsigned long long state;
+		char padding[64 - sizeof(unsigned long long)];
+
+		Random(unsigned long long s = 0) { seed(s); }
+
+		void seed(unsigned long long s)
+		{
+			state = mix(s);
+			if (!state)
+				state = 1;
 		}
-		GLdouble** getPoints(format shape, GLuint count)
+		void seed(GLuint s, GLint x, GLint y, GLuint sample)
+		{ seed(mix(mix(mix(s) ^ (GLuint)x) ^ (GLuint)y) ^ sample); }
+
+		//xorshift64*, uniform in [0,1)
+		GLdouble rand()
 		{
-			GLdouble** ret = new GLdouble*[2];
-	
-			ret[0] = new GLdouble[count];
-			ret[1] = new GLdouble[count];
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			return ((state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+		}
+		GLdouble operator()() { return rand(); }
 
-			switch(shape)
-			{
-				case circle:
-					for(GLuint i = 0; i < count; i++) {
-						ret[0][i] = cos(i*6.28318530718/count);
-						ret[1][i] = sin(i*6.28318530718/count);
-					}
-				default:
-					break;
-			}
+	};
 
-			return ret;
+	namespace Sampling {
+		//a random point in the unit disc, denser towards the middle
+		template<class Generator>
+		inline void disc(Generator& random, Scalar& x, Scalar& y)
+		{
+			Scalar a = 6.28318530718 * random.rand();
+			Scalar r = random.rand() + random.rand();
+			if (r > 1)
+				r = 2 - r;
+			x = r*cos(a);
+			y = r*sin(a);
+		}
+
+		//the i-th of count points evenly spread on the unit circle
+		inline void ring(GLuint i, GLuint count, Scalar& x, Scalar& y)
+		{
+			x = cos(i*6.28318530718/count);
+			y = sin(i*6.28318530718/count);
 		}
 
 		const GLdouble square_x[] = { 0, -0.5, 0.5,  0.5, -0.5,
@@ -140,10 +190,10 @@ namespace RayTrace {
 
 	struct Color
 	{
-		GLdouble red, green, blue;
+		Scalar red, green, blue;
 
-		Color (GLdouble r, GLdouble g, GLdouble b):red(r),green(g),blue(b) { }
-		Color (GLdouble gray):red(gray),green(gray),blue(gray) { }
+		Color (Scalar r, Scalar g, Scalar b):red(r),green(g),blue(b) { }
+		Color (Scalar gray):red(gray),green(gray),blue(gray) { }
 		Color ():red(0),green(0),blue(0) { }
 	};
 
@@ -151,13 +201,15 @@ namespace RayTrace {
 
 	struct Point
 	{
-		GLdouble x,y,z;
+		Scalar x,y,z;
 
 		Point ():x(0),y(0),z(0) { }
-		Point (GLdouble i, GLdouble j, GLdouble k):x(i),y(j),z(k) { }
+		Point (Scalar i, Scalar j, Scalar k):x(i),y(j),z(k) { }
 		
-		GLdouble length() { return sqrt(*this * *this); }
+		Scalar length() { return sqrt(*this * *this); }
 		Point unitary() { return *this/length(); }
+
+		Scalar operator[](GLuint axis) const { return axis == 0 ? x : axis == 1 ? y : z; }
 	};
 
 	const Point origin;
@@ -165,11 +217,11 @@ namespace RayTrace {
 	struct Ray
 	{
 		Point origin, direction;
-		GLdouble strength;
+		Scalar strength;
 
 		Ray():origin(RayTrace::origin),direction(RayTrace::origin),strength(0) { }
 		Ray(Point a, Point b):origin(a),direction(b),strength(0) { }
-		Ray(Point a, Point b, GLdouble str):origin(a),direction(b),strength(str) { }
+		Ray(Point a, Point b, Scalar str):origin(a),direction(b),strength(str) { }
 	};
 
 	struct Line
@@ -181,15 +233,15 @@ namespace RayTrace {
 
 		Point toPoint() { return origin - destiny; }
 		Ray toRay() { return Ray(origin,direction(),length()); }
-		Ray toRay(GLdouble strength) { return Ray(origin,direction(),strength); }
-		GLdouble length() { return toPoint().length(); }
+		Ray toRay(Scalar strength) { return Ray(origin,direction(),strength); }
+		Scalar length() { return toPoint().length(); }
 		Point direction() { return (destiny-origin).unitary(); }
 	};
 
 	struct Intersection
 	{
 		Point where, normal;
-		GLdouble length;
+		Scalar length;
 		GLuint index;
 		Intersection():length(-1),index(0) { }
 	};
@@ -200,14 +252,14 @@ namespace RayTrace {
 		Point lookFrom;
 		Point up;
 
-		GLdouble near;
-		GLdouble far;
-		GLdouble fovY;
+		Scalar near;
+		Scalar far;
+		Scalar fovY;
 
-		GLdouble lensHeight;
+		Scalar lensHeight;
 
 		Camera(Point at, Point from, Point up,
-			   GLdouble near, GLdouble far, GLdouble fovy, GLdouble lensHeight)
+			   Scalar near, Scalar far, Scalar fovy, Scalar lensHeight)
 		:lookAt(at),lookFrom(from),up(up),near(near),far(far),fovY(fovy),lensHeight(lensHeight) { }
 
 		Camera(Camera const& c)
@@ -215,18 +267,82 @@ namespace RayTrace {
 		 fovY(c.fovY),lensHeight(c.lensHeight) { }
 	};
 
+	//the matrices gluLookAt and gluPerspective would load, column major,
+	//so cameras don't need a GL context
+	void lookAt(GLdouble* m, Point from, Point at, Point up)
+	{
+		Point forward = (at - from).unitary();
+		Point side = (forward % up).unitary();
+		up = side % forward;
+
+		GLdouble r[16] = { side.x, up.x, -forward.x, 0,
+						   side.y, up.y, -forward.y, 0,
+						   side.z, up.z, -forward.z, 0,
+						   -(side*from), -(up*from), forward*from, 1 };
+		for (GLuint i = 0; i < 16; i++)
+			m[i] = r[i];
+	}
+	void perspective(GLdouble* m, GLdouble fovY, GLdouble aspect, GLdouble near, GLdouble far)
+	{
+		GLdouble radians = fovY / 2 * M_PI / 180;
+		GLdouble cotangent = cos(radians) / sin(radians);
+
+		for (GLuint i = 0; i < 16; i++)
+			m[i] = 0;
+		m[0] = cotangent / aspect;
+		m[5] = cotangent;
+		m[10] = -(far + near) / (far - near);
+		m[11] = -1;
+		m[14] = -2 * near * far / (far - near);
+	}
+	//ret = a * b
+	void multiply(GLdouble* ret, GLdouble const* a, GLdouble const* b)
+	{
+		for (GLuint i = 0; i < 4; i++)
+			for (GLuint j = 0; j < 4; j++)
+				ret[4*j + i] = a[i]*b[4*j] + a[4+i]*b[4*j+1] + a[8+i]*b[4*j+2] + a[12+i]*b[4*j+3];
+	}
+	//cofactor expansion, like GLU; returns false for singular matrices
+	bool invert(GLdouble* ret, GLdouble const* m)
+	{
+		GLdouble inv[16];
+		inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+		inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+		inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+		inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+		inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+		inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+		inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+		inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+		inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+		inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+		inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+		inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+		inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+		inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+		inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+		inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+		GLdouble det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+		if (det == 0)
+			return false;
+		for (GLuint i = 0; i < 16; i++)
+			ret[i] = inv[i] / det;
+		return true;
+	}
+
 	struct Material
 	{
 		Color diffuse;
 		Color specular;
 		
-		GLdouble reflection;
-		GLdouble shinny;
-		GLdouble ambient;
+		Scalar reflection;
+		Scalar shinny;
+		Scalar ambient;
 
 		Color color;
 
-		Material(Color diff, Color spec, GLdouble ref, GLdouble shine, GLdouble amb, Color c)
+		Material(Color diff, Color spec, Scalar ref, Scalar shine, Scalar amb, Color c)
 		: specular(spec), diffuse(diff), reflection(ref), shinny(shine), ambient(amb), color(c) { }
 
 		bool operator==(Material const& m)
@@ -236,193 +352,246 @@ namespace RayTrace {
 		}
 	};
 
+	struct Box
+	{
+		Point lower, upper;
+
+		Box ():lower(HUGE_VAL,HUGE_VAL,HUGE_VAL),upper(-HUGE_VAL,-HUGE_VAL,-HUGE_VAL) { }
+		Box (Point l, Point u):lower(l),upper(u) { }
+
+		void grow(Point const& p)
+		{
+			lower = Point(minimum(lower.x,p.x),minimum(lower.y,p.y),minimum(lower.z,p.z));
+			upper = Point(maximum(upper.x,p.x),maximum(upper.y,p.y),maximum(upper.z,p.z));
+		}
+		void grow(Box const& b) { grow(b.lower); grow(b.upper); }
+
+		Point center() const { return Point((lower.x+upper.x)/2,(lower.y+upper.y)/2,(lower.z+upper.z)/2); }
+		Scalar area() const
+		{
+			if (lower.x > upper.x)
+				return 0;
+			Point d(upper.x-lower.x,upper.y-lower.y,upper.z-lower.z);
+			return 2*(d.x*d.y + d.y*d.z + d.z*d.x);
+		}
+
+		//slab test against a ray given by its origin and per-axis inverse direction
+		bool intersect(Point const& origin, Point const& inverse, Scalar distance, Scalar& near) const
+		{
+			Scalar t0 = (lower.x - origin.x) * inverse.x, t1 = (upper.x - origin.x) * inverse.x;
+			Scalar tmin = minimum(t0,t1), tmax = maximum(t0,t1);
+			t0 = (lower.y - origin.y) * inverse.y; t1 = (upper.y - origin.y) * inverse.y;
+			tmin = maximum(tmin,minimum(t0,t1)); tmax = minimum(tmax,maximum(t0,t1));
+			t0 = (lower.z - origin.z) * inverse.z; t1 = (upper.z - origin.z) * inverse.z;
+			tmin = maximum(tmin,minimum(t0,t1)); tmax = minimum(tmax,maximum(t0,t1));
+
+			near = tmin;
+			return tmax >= maximum(tmin,0) && tmin <= distance;
+		}
+	};
+
+	//1/direction with zero components replaced by a large finite value, since
+	//-ffast-math does not let the slab tests rely on infinities
+	inline Point inverse(Point const& d)
+	{
+		return Point(1/(d.x != 0 ? d.x : 1e-15),
+					 1/(d.y != 0 ? d.y : 1e-15),
+					 1/(d.z != 0 ? d.z : 1e-15));
+	}
+
 	struct Object
 	{
 		Point position;
 		Point up;
 		GLint material;
-		GLdouble scale;
+		Scalar scale;
+
+		Box bounds;
 
-		Object(Point pos, Point up, GLint material, GLdouble scale)
+		Object(Point pos, Point up, GLint material, Scalar scale)
 		: position(pos),up(up),material(material),scale(scale) { }
+		virtual ~Object() { }
 		virtual Intersection intersect(Ray const&) = 0;
+		virtual void refresh() = 0;
+
+		//whether the object lies on the ray before ray.strength. A convex
+		//object never shadows its own surface (self), see World::occluded.
+		virtual bool blocks(Ray const& ray, bool self)
+		{
+			if (self)
+				return false;
+			Intersection tmp = intersect(ray);
+			return tmp.length >= 0 && tmp.length < ray.strength;
+		}
 	};
 
 	struct Cube : Object
 	{
-		Cube (Point pos, Point up, GLdouble side)
-		: Object(pos,up,0,side) { }
+		Cube (Point pos, Point up, Scalar side)
+		: Object(pos,up,0,side) { refresh(); }
 
-		Intersection intersect(Ray const& ray)
+		void refresh()
+		{
+			bounds = Box(position - Point(scale/2,scale/2,scale/2),
+						 position + Point(scale/2,scale/2,scale/2));
+		}
+
+		Intersection intersect(Ray const& ray) { return intersect(bounds, ray); }
+
+		//slab test against the precomputed bounds. Axes are clipped in the
+		//order the faces used to be tested (top, bottom, front, back, right,
+		//left) so ties on edges resolve to the same face as before. Static,
+		//so the hierarchy's leaves call it on their copies of the bounds
+		//without a virtual call, but out of line: inlined, -Ofast fuses it
+		//differently at each call site, and packets would no longer agree
+		//with single rays to the bit.
+		__attribute__((noinline))
+		static Intersection intersect(Box const& bounds, Ray const& ray)
 		{
 			Intersection ret;
-			ret.length = -1;
-
-			Point vertices[8];
-			vertices[0] = position + Point(scale/2,scale/2,-scale/2);
-			vertices[1] = position + Point(scale/2,scale/2,scale/2);
-			vertices[2] = position + Point(-scale/2,scale/2,-scale/2);
-			vertices[3] = position + Point(-scale/2,scale/2,scale/2);
-			vertices[4] = position + Point(-scale/2,-scale/2,scale/2);
-			vertices[5] = position + Point(scale/2,-scale/2,scale/2);
-			vertices[6] = position + Point(scale/2,-scale/2,-scale/2);
-			vertices[7] = position + Point(-scale/2,-scale/2,-scale/2);
-
-			intersectPlane(vertices[3],vertices[1],vertices[2], ray, ret); //top
-			intersectPlane(vertices[6],vertices[5],vertices[7], ray, ret); //bottom
-			intersectPlane(vertices[1],vertices[3],vertices[5], ray, ret); //front
-			intersectPlane(vertices[7],vertices[2],vertices[6], ray, ret); //back
-			intersectPlane(vertices[0],vertices[1],vertices[6], ray, ret); //right
-			intersectPlane(vertices[4],vertices[3],vertices[7], ray, ret); //left
+			GLuint face;
+			ret.length = distance(bounds, ray, face);
+			if (ret.length >= 0) {
+				ret.where = ray.origin + ret.length*ray.direction;
+				ret.normal = normals[face];
+			}
 			return ret;
 		}
 
+		//how far along the ray the cube is hit, or -1, and through which face
+		static Scalar distance(Box const& bounds, Ray const& ray, GLuint& face)
+		{
+			Scalar near = -HUGE_VAL, far = HUGE_VAL;
+			GLuint farFace = 0;
+			face = 0;
+			if (!clip(ray.origin.y, ray.direction.y, bounds.lower.y, bounds.upper.y, 0, near, far, face, farFace) ||
+				!clip(ray.origin.z, ray.direction.z, bounds.lower.z, bounds.upper.z, 2, near, far, face, farFace) ||
+				!clip(ray.origin.x, ray.direction.x, bounds.lower.x, bounds.upper.x, 4, near, far, face, farFace))
+				return -1;
+
+			//rays starting inside the cube leave through the far face
+			if (near < PRECISION) {
+				if (far < PRECISION)
+					return -1;
+				face = farFace;
+				return far;
+			}
+			return near;
+		}
+
+		//outward normals, positive face first on each axis
+		static const Point normals[6];
+
 		private:
-			void intersectPlane(Point const& pivot, Point const& a, Point const& b,
-								Ray const& ray, Intersection& i)
+			static bool clip(Scalar origin, Scalar direction, Scalar lower, Scalar upper, GLuint face,
+							 Scalar& near, Scalar& far, GLuint& nearFace, GLuint& farFace)
 			{
-				Point n = Line(pivot,a).direction() % Line(pivot,b).direction();
-				GLdouble denominator = ray.direction * n;
-				if (denominator != 0) {
-					GLdouble numerator = (pivot - ray.origin) * n;
-					numerator /= denominator;
-
-					if (numerator < PRECISION)
-						return;
-
-					Point p(ray.origin + numerator*ray.direction);
-					Point q(p - position);
-
-					GLdouble x = fabs(q.x)-scale/2;
-					GLdouble y = fabs(q.y)-scale/2;
-					GLdouble z = fabs(q.z)-scale/2;
-
-					if (x > PRECISION || y > PRECISION || z > PRECISION)
-						return;
-
-					GLdouble len = Line(p,ray.origin).length();
-					if (i.length == -1 || len - i.length < 0) {
-						i.where = p;
-						i.normal = n;
-						i.length = len;
-					}
+				if (direction == 0)
+					return origin >= lower && origin <= upper;
+
+				Scalar t0 = (lower - origin)/direction;
+				Scalar t1 = (upper - origin)/direction;
+				GLuint f0 = face + 1, f1 = face;
+				if (direction < 0) {
+					Scalar t = t0; t0 = t1; t1 = t;
+					f0 = face; f1 = face + 1;
+				}
+				if (t0 > near) {
+					near = t0;
+					nearFace = f0;
 				}
+				if (t1 < far) {
+					far = t1;
+					farFace = f1;
+				}
+				return near <= far;
 			}
 	};
 
+	const Point Cube::normals[6] = { Point(0,1,0), Point(0,-1,0), Point(0,0,1),
+									 Point(0,0,-1), Point(1,0,0), Point(-1,0,0) };
+
 	struct Sphere : Object
 	{
-		Sphere(Point pos, Point up, GLdouble radius)
-		: Object(pos,up,0,radius) { }
+		Sphere(Point pos, Point up, Scalar radius)
+		: Object(pos,up,0,radius) { refresh(); }
 
-		Intersection intersect(Ray const& ray)
+		void refresh()
 		{
-			Point oc = ray.origin - position;
-
-			GLdouble b = ray.direction * oc;
-			GLdouble c = oc * oc;
-			GLdouble delta = b*b - c + scale*scale;
-
-			Intersection ret;
-			ret.length = -1;
-
-			if (fabs(delta) >= PRECISION) {
-				Point solutions[2];
-				GLdouble roots[2];
-				GLdouble lengths[2];
-				GLint i = 0;
+			bounds = Box(position - Point(scale,scale,scale),
+						 position + Point(scale,scale,scale));
+		}
 
-				roots[0] = -b + sqrt(delta);
-				roots[1] = -b - sqrt(delta);
+		Intersection intersect(Ray const& ray) { return intersect(position, scale, ray); }
 
-				solutions[0] = ray.origin + roots[0]*ray.direction;
-				solutions[1] = ray.origin + roots[1]*ray.direction;
+		//static and out of line for the same reasons as Cube's
+		__attribute__((noinline))
+		static Intersection intersect(Point const& position, Scalar scale, Ray const& ray)
+		{
+			return resolve(position, scale, ray, distance(position, scale, ray));
+		}
 
-				lengths[0] = Line(ray.origin, solutions[0]).length();
-				lengths[1] = Line(ray.origin, solutions[1]).length();
+		//how far along the ray the sphere is hit, or -1: the nearer root
+		//unless it lies behind the origin. Directions are unit long, so the
+		//root is the length and nothing else is needed to pick a hit.
+		static Scalar distance(Point const& position, Scalar scale, Ray const& ray)
+		{
+			Point oc = ray.origin - position;
 
-				if(roots[0] < PRECISION)
-					if(roots[1] < PRECISION)
-						return ret;
-					else
-						i = 1;
-				else if (roots[1] > PRECISION && lengths[1] < lengths[0])
-					i = 1;
+			Scalar b = ray.direction * oc;
+			Point v = oc - b*ray.direction;
+			Scalar delta = scale*scale - v*v;
+			if (delta < PRECISION)
+				return -1;
+
+			Scalar root = sqrt(delta);
+			if (-b - root > PRECISION)
+				return -b - root;
+			if (-b + root >= PRECISION)
+				return -b + root;
+			return -1;
+		}
 
-				ret.where = solutions[i];
-				ret.length = lengths[i];
-				ret.normal = (solutions[i] - position)/scale;
+		//the point and normal of a hit at that distance
+		static Intersection resolve(Point const& position, Scalar scale, Ray const& ray, Scalar distance)
+		{
+			Intersection ret;
+			ret.length = distance;
+			if (distance >= 0) {
+				ret.where = ray.origin + distance*ray.direction;
+				ret.normal = (ret.where - position)/scale;
 			}
-
 			return ret;
 		}
 	};
 
-	Point* intersectionPoints(GLuint sampling, Point position, Point where,
-							  GLdouble radius, bool random = true)
-	{
-		static MTRand twister;
-
-		Point* ret = new Point[sampling];
-		ret[0] = position;
-		if (sampling > 1) {
-			Point normal;
-			Point x;
-			Point y;
-
-			GLdouble** points = 0;
-
-			normal = (position - where).unitary();
-			x = Point(1,0,0) * normal == 0 ?
-				Point(0,0,1) - (Point(0,0,1)*normal)*normal :
-				Point(1,0,0) - (Point(1,0,0)*normal)*normal;
-			y = x % normal;
-
-			if (random)
-				points = Sampling::getPoints(Sampling::circle, sampling, twister);
-			else
-				points = Sampling::getPoints(Sampling::circle, sampling);
-
-			for (GLuint i = 1; i < sampling; i++)
-				ret[i] = position + points[0][i]*radius*x + points[1][i]*radius*y;
-
-			delete[] points[0];
-			delete[] points[1];
-			delete[] points;
-		}
-
-		return ret;
-	}
-
+	//points on a disc of the given radius around position, facing where:
+	//random ones when a generator is given, an even ring otherwise. The
+	//first one is always the center. Nothing is allocated, ret must hold
+	//sampling points.
 	inline void intersectionPoints(Point* ret, GLuint sampling, Point position, Point where,
-								   GLdouble radius, bool random = true)
+								   Scalar radius, Random* random = 0)
 	{
-		static MTRand twister;
 		ret[0] = position;
 		if (sampling > 1) {
 			Point normal;
 			Point x;
 			Point y;
 
-			GLdouble** points = 0;
-
 			normal = (position - where).unitary();
 			x = Point(1,0,0) * normal == 0 ?
 				Point(0,0,1) - (Point(0,0,1)*normal)*normal :
 				Point(1,0,0) - (Point(1,0,0)*normal)*normal;
 			y = x % normal;
 
-			if (random)
-				points = Sampling::getPoints(Sampling::circle, sampling, twister);
-			else
-				points = Sampling::getPoints(Sampling::circle, sampling);
-
-			for (GLuint i = 1; i < sampling; i++)
-				ret[i] = position + points[0][i]*radius*x + points[1][i]*radius*y;
-
-			delete[] points[0];
-			delete[] points[1];
-			delete[] points;
+			Scalar a, b;
+			for (GLuint i = 1; i < sampling; i++) {
+				if (random)
+					Sampling::disc(*random, a, b);
+				else
+					Sampling::ring(i, sampling, a, b);
+				ret[i] = position + a*radius*x + b*radius*y;
+			}
 		}
 	}
 
@@ -430,223 +599,3033 @@ namespace RayTrace {
 	{
 		Point position;
 		Color color;
-		GLdouble intensity;
-		GLdouble radius;
+		Scalar intensity;
+		Scalar radius;
 		bool cube;
 
-		Light(Point p, Color c, GLdouble i, GLdouble r, bool cube = false)
+		Light(Point p, Color c, Scalar i, Scalar r, bool cube = false)
 		: position(p),color(c),intensity(i),radius(r),cube(cube) { }
-
-		Point* intersectionPoints(GLuint sampling, Point where) const
-		{ return RayTrace::intersectionPoints(sampling,position,where,radius); }
 	};
 
-	struct World {
-		std::vector<Object*> objects;
-		std::vector<Material> materials;
-		std::vector<Light> lights;
-		GLdouble ambientIntensity;
-		
-		World(GLdouble light):ambientIntensity(light) { }
-		void add(Light const& l) { lights.push_back(l); }
-		void add(Object* const& obj, Material const& m)
-		{
-			objects.push_back(obj);
-			for (GLuint i = 0; i < materials.size(); i++)
-				if (materials[i] == m) {
-					objects[objects.size()-1]->material = i;
-					return;
-				}
-			materials.push_back(m);
-			objects[objects.size()-1]->material = materials.size() - 1;
-		}
-		Intersection intersect(Ray const& ray) const
+	//SIMD helpers for the multi-object kernels: LANES Scalars at a time,
+	//which is four doubles or eight floats (RAYTRACE_FLOAT) with AVX2, two
+	//doubles or four floats with SSE2, and one plain scalar otherwise
+	namespace SIMD {
+		#if defined(RAYTRACE_FLOAT) && defined(__AVX2__)
+		const GLuint LANES = 8;
+		typedef __m256 Vector;
+
+		inline Vector load(Scalar const* p) { return _mm256_load_ps(p); }
+		inline void store(Scalar* p, Vector a) { _mm256_store_ps(p, a); }
+		inline Vector set(Scalar a) { return _mm256_set1_ps(a); }
+		inline Vector add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+		inline Vector sub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+		inline Vector mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+		inline Vector min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+		inline Vector max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+		inline Vector sqrt(Vector a) { return _mm256_sqrt_ps(a); }
+		inline Vector less(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		inline Vector lessEqual(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		inline Vector both(Vector a, Vector b) { return _mm256_and_ps(a, b); }
+		inline Vector select(Vector mask, Vector a, Vector b) { return _mm256_blendv_ps(b, a, mask); }
+		inline GLuint mask(Vector a) { return _mm256_movemask_ps(a); }
+		#elif defined(RAYTRACE_FLOAT) && defined(__SSE2__)
+		const GLuint LANES = 4;
+		typedef __m128 Vector;
+
+		inline Vector load(Scalar const* p) { return _mm_load_ps(p); }
+		inline void store(Scalar* p, Vector a) { _mm_store_ps(p, a); }
+		inline Vector set(Scalar a) { return _mm_set1_ps(a); }
+		inline Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+		inline Vector sub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+		inline Vector mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+		inline Vector min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+		inline Vector max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+		inline Vector sqrt(Vector a) { return _mm_sqrt_ps(a); }
+		inline Vector less(Vector a, Vector b) { return _mm_cmplt_ps(a, b); }
+		inline Vector lessEqual(Vector a, Vector b) { return _mm_cmple_ps(a, b); }
+		inline Vector both(Vector a, Vector b) { return _mm_and_ps(a, b); }
+		inline Vector select(Vector mask, Vector a, Vector b)
+		{ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+		inline GLuint mask(Vector a) { return _mm_movemask_ps(a); }
+		#elif defined(__AVX2__)
+		const GLuint LANES = 4;
+		typedef __m256d Vector;
+
+		inline Vector load(Scalar const* p) { return _mm256_load_pd(p); }
+		inline void store(Scalar* p, Vector a) { _mm256_store_pd(p, a); }
+		inline Vector set(Scalar a) { return _mm256_set1_pd(a); }
+		inline Vector add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+		inline Vector sub(Vector a, Vector b) { return _mm256_sub_pd(a, b); }
+		inline Vector mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+		inline Vector min(Vector a, Vector b) { return _mm256_min_pd(a, b); }
+		inline Vector max(Vector a, Vector b) { return _mm256_max_pd(a, b); }
+		inline Vector sqrt(Vector a) { return _mm256_sqrt_pd(a); }
+		inline Vector less(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+		inline Vector lessEqual(Vector a, Vector b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+		inline Vector both(Vector a, Vector b) { return _mm256_and_pd(a, b); }
+		inline Vector select(Vector mask, Vector a, Vector b) { return _mm256_blendv_pd(b, a, mask); }
+		inline GLuint mask(Vector a) { return _mm256_movemask_pd(a); }
+		#elif defined(__SSE2__)
+		const GLuint LANES = 2;
+		typedef __m128d Vector;
+
+		inline Vector load(Scalar const* p) { return _mm_load_pd(p); }
+		inline void store(Scalar* p, Vector a) { _mm_store_pd(p, a); }
+		inline Vector set(Scalar a) { return _mm_set1_pd(a); }
+		inline Vector add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+		inline Vector sub(Vector a, Vector b) { return _mm_sub_pd(a, b); }
+		inline Vector mul(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+		inline Vector min(Vector a, Vector b) { return _mm_min_pd(a, b); }
+		inline Vector max(Vector a, Vector b) { return _mm_max_pd(a, b); }
+		inline Vector sqrt(Vector a) { return _mm_sqrt_pd(a); }
+		inline Vector less(Vector a, Vector b) { return _mm_cmplt_pd(a, b); }
+		inline Vector lessEqual(Vector a, Vector b) { return _mm_cmple_pd(a, b); }
+		inline Vector both(Vector a, Vector b) { return _mm_and_pd(a, b); }
+		inline Vector select(Vector mask, Vector a, Vector b)
+		{ return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+		inline GLuint mask(Vector a) { return _mm_movemask_pd(a); }
+		#else
+		const GLuint LANES = 1;
+		typedef Scalar Vector;
+
+		inline Vector load(Scalar const* p) { return *p; }
+		inline void store(Scalar* p, Vector a) { *p = a; }
+		inline Vector set(Scalar a) { return a; }
+		inline Vector add(Vector a, Vector b) { return a + b; }
+		inline Vector sub(Vector a, Vector b) { return a - b; }
+		inline Vector mul(Vector a, Vector b) { return a * b; }
+		inline Vector min(Vector a, Vector b) { return minimum(a, b); }
+		inline Vector max(Vector a, Vector b) { return maximum(a, b); }
+		inline Vector sqrt(Vector a) { return ::sqrt(a); }
+		inline Vector less(Vector a, Vector b) { return a < b; }
+		inline Vector lessEqual(Vector a, Vector b) { return a <= b; }
+		inline Vector both(Vector a, Vector b) { return a != 0 && b != 0; }
+		inline Vector select(Vector mask, Vector a, Vector b) { return mask != 0 ? a : b; }
+		inline GLuint mask(Vector a) { return a != 0; }
+		#endif
+
+		//growable array of scalars aligned for vector loads
+		struct Lanes
 		{
-			Intersection ret, tmp;
-			GLdouble distance = ray.strength;
-			for(GLuint i = 0; i < objects.size(); i++) {
-				tmp = objects[i]->intersect(ray);
-				if (tmp.length >= 0)
-					if (tmp.length < distance) {
-						distance = tmp.length;
-						ret = tmp;
-						ret.index = i;
-					}
-			}
+			Scalar* data;
+			GLuint size, capacity;
 
-			return ret;
-		}
-	};
+			Lanes():data(0),size(0),capacity(0) { }
+			~Lanes() { free(data); }
 
-	void plot(Color c, GLdouble x, GLdouble y)
-	{
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
+			void clear() { size = 0; }
+			void push(Scalar value)
+			{
+				if (size == capacity) {
+					void* grown = 0;
+					capacity = capacity ? 2*capacity : 64;
+					if (posix_memalign(&grown, 32, capacity * sizeof(Scalar)))
+						abort();
+					for (GLuint i = 0; i < size; i++)
+						((Scalar*)grown)[i] = data[i];
+					free(data);
+					data = (Scalar*)grown;
+				}
+				data[size++] = value;
+			}
+			Scalar const* operator+(GLuint offset) const { return data + offset; }
 
-		glBegin(GL_QUADS);
-		glColor3d(c.red, c.green, c.blue);
-		glVertex2d(x, y);
-		glVertex2d(x, y+1);
-		glVertex2d(x+1, y+1);
-		glVertex2d(x+1, y);
-		glEnd();
+			private:
+				Lanes(Lanes const&);
+				Lanes& operator=(Lanes const&);
+		};
 	}
 
-	template<GLuint antialias, GLuint depthRays, GLuint shadows, GLuint interreflections>
-	struct RayData
+	//structure of arrays copy of the spheres and cubes, grouped so every
+	//group starts on a vector boundary. Padding lanes can never be hit:
+	//spheres get a hugely negative squared radius and cubes collapse to a
+	//point far beyond any ray.
+	struct Primitives
 	{
-		GLdouble compensation;
-		GLdouble shadows_compensation;
-		GLdouble interreflections_compensation;
-
-		GLdouble modelview[16], projection[16];
-		GLint viewport[4];
-
-		Color** buffer;
-
-		Camera camera;
+		SIMD::Lanes sphereX, sphereY, sphereZ, sphereR, sphereR2;
+		SIMD::Lanes lowerX, lowerY, lowerZ, upperX, upperY, upperZ;
 
-		bool changed;
-
-		RayData()
-		: compensation(1/((GLdouble)(antialias * depthRays))),
-		  shadows_compensation(1/((GLdouble)shadows)),
-		  interreflections_compensation(1/((GLdouble)interreflections)),
-		  buffer(0),camera(Camera(origin,origin,origin,0,0,0,0)),changed(false)
-		{ }
-		RayData(Camera c)
-		: compensation(1/((GLdouble)(antialias * depthRays))),
-		  shadows_compensation(1/((GLdouble)shadows)),
-		  interreflections_compensation(1/((GLdouble)interreflections)),
-		  buffer(0),camera(c),changed(true)
+		void clear()
 		{
-			init();
+			sphereX.clear(); sphereY.clear(); sphereZ.clear(); sphereR.clear(); sphereR2.clear();
+			lowerX.clear(); lowerY.clear(); lowerZ.clear();
+			upperX.clear(); upperY.clear(); upperZ.clear();
 		}
 
-		void refreshCamera()
+		void push(Sphere const& s)
 		{
-			changed = true;
-			static GLdouble m[16], p[16];
-			glGetDoublev (GL_MODELVIEW_MATRIX, m);
-			glGetDoublev (GL_PROJECTION_MATRIX, p);
-
-			glMatrixMode(GL_MODELVIEW);
-			glLoadIdentity();
-			gluLookAt(camera.lookFrom.x, camera.lookFrom.y, camera.lookFrom.z,
-					  camera.lookAt.x, camera.lookAt.y, camera.lookAt.z,
-					  camera.up.x, camera.up.y, camera.up.z);
-
-			glMatrixMode(GL_PROJECTION);
-			glLoadIdentity();
-			gluPerspective(camera.fovY, (GLdouble) viewport[2]/viewport[3], camera.near, camera.far);
-			
-			glGetDoublev (GL_MODELVIEW_MATRIX, modelview);
-			glGetDoublev (GL_PROJECTION_MATRIX, projection);
-
-			glMatrixMode(GL_MODELVIEW);
-			glLoadIdentity();
-			glMultMatrixd(m);
+			sphereX.push(s.position.x);
+			sphereY.push(s.position.y);
+			sphereZ.push(s.position.z);
+			sphereR.push(s.scale);
+			sphereR2.push(s.scale*s.scale);
+		}
+		void push(Cube const& c)
+		{
+			lowerX.push(c.bounds.lower.x); lowerY.push(c.bounds.lower.y); lowerZ.push(c.bounds.lower.z);
+			upperX.push(c.bounds.upper.x); upperY.push(c.bounds.upper.y); upperZ.push(c.bounds.upper.z);
+		}
 
-			glMatrixMode(GL_PROJECTION);
-			glLoadIdentity();
-			glMultMatrixd(p);			
+		//pads both groups to a multiple of LANES and returns where the next ones start
+		void align(GLuint& spheres, GLuint& cubes)
+		{
+			while (sphereX.size % SIMD::LANES) {
+				sphereX.push(0); sphereY.push(0); sphereZ.push(0);
+				sphereR.push(0); sphereR2.push(-1e30);
+			}
+			while (lowerX.size % SIMD::LANES) {
+				lowerX.push(1e30); lowerY.push(1e30); lowerZ.push(1e30);
+				upperX.push(1e30); upperY.push(1e30); upperZ.push(1e30);
+			}
+			spheres = sphereX.size;
+			cubes = lowerX.size;
 		}
 
-		void changeCamera(Camera& c)
+		//the whole hit on the sphere or cube in a lane, from the copies alone
+		Intersection sphere(GLuint lane, Ray const& ray) const
 		{
-			camera = c;
-			refreshCamera();
+			return Sphere::intersect(Point(sphereX.data[lane],sphereY.data[lane],sphereZ.data[lane]),
+									 sphereR.data[lane], ray);
+		}
+		Intersection cube(GLuint lane, Ray const& ray) const
+		{
+			return Cube::intersect(Box(Point(lowerX.data[lane],lowerY.data[lane],lowerZ.data[lane]),
+									   Point(upperX.data[lane],upperY.data[lane],upperZ.data[lane])), ray);
+		}
+		//only how far along the ray they are, or -1
+		Scalar sphereDistance(GLuint lane, Ray const& ray) const
+		{
+			return Sphere::distance(Point(sphereX.data[lane],sphereY.data[lane],sphereZ.data[lane]),
+									sphereR.data[lane], ray);
+		}
+		Scalar cubeDistance(GLuint lane, Ray const& ray) const
+		{
+			GLuint face;
+			return Cube::distance(Box(Point(lowerX.data[lane],lowerY.data[lane],lowerZ.data[lane]),
+									  Point(upperX.data[lane],upperY.data[lane],upperZ.data[lane])), ray, face);
 		}
 
-		void init()
+		//closest sphere among `count` lanes from `first` that is no further than
+		//`distance`. Returns its offset from `first` (or -1) and its distance in `t`.
+		//Same arithmetic as Sphere::intersect, one vector of spheres at a time.
+		GLint spheres(GLuint first, GLuint count, Ray const& ray, Scalar distance, Scalar& t) const
 		{
-			glGetIntegerv (GL_VIEWPORT, viewport);
-			refreshCamera();
-			buffer = new Color*[viewport[2]];
-			for (GLint i = 0; i < viewport[2]; i++)
-				buffer[i] = new Color[viewport[3]];
-			
-			glMatrixMode(GL_MODELVIEW);
+			using namespace SIMD;
+			Vector ox = set(ray.origin.x), oy = set(ray.origin.y), oz = set(ray.origin.z);
+			Vector dx = set(ray.direction.x), dy = set(ray.direction.y), dz = set(ray.direction.z);
+			Vector precision = set(PRECISION), zero = set(0), limit = set(distance);
+
+			GLint ret = -1;
+			t = distance;
+			for (GLuint k = first; k < first + count; k += LANES) {
+				Vector x = sub(ox, load(sphereX + k));
+				Vector y = sub(oy, load(sphereY + k));
+				Vector z = sub(oz, load(sphereZ + k));
+
+				Vector b = add(add(mul(dx, x), mul(dy, y)), mul(dz, z));
+				x = sub(x, mul(b, dx)); y = sub(y, mul(b, dy)); z = sub(z, mul(b, dz));
+				Vector c = add(add(mul(x, x), mul(y, y)), mul(z, z));
+				Vector delta = sub(load(sphereR2 + k), c);
+
+				Vector root = sqrt(max(delta, zero));
+				Vector near = sub(sub(zero, b), root);
+				Vector far = add(sub(zero, b), root);
+				Vector hit = select(less(precision, near), near, far);
+
+				Vector valid = both(both(lessEqual(precision, delta), lessEqual(precision, hit)),
+									lessEqual(hit, limit));
+				if (mask(valid))
+					closest(valid, hit, k - first, ret, t);
+			}
+			return ret;
 		}
 
-		void refresh()
+		//closest cube, as above, with the slab test of Cube::intersect
+		GLint cubes(GLuint first, GLuint count, Ray const& ray, Point const& inverse,
+					Scalar distance, Scalar& t) const
 		{
-			for (GLint i = 0; i < viewport[2]; i++)
-				delete[] buffer[i];
-			delete[] buffer;
-			init();
+			using namespace SIMD;
+			Vector ox = set(ray.origin.x), oy = set(ray.origin.y), oz = set(ray.origin.z);
+			Vector ix = set(inverse.x), iy = set(inverse.y), iz = set(inverse.z);
+			Vector precision = set(PRECISION), limit = set(distance);
+
+			GLint ret = -1;
+			t = distance;
+			for (GLuint k = first; k < first + count; k += LANES) {
+				Vector t0 = mul(sub(load(lowerX + k), ox), ix), t1 = mul(sub(load(upperX + k), ox), ix);
+				Vector near = min(t0, t1), far = max(t0, t1);
+				t0 = mul(sub(load(lowerY + k), oy), iy); t1 = mul(sub(load(upperY + k), oy), iy);
+				near = max(near, min(t0, t1)); far = min(far, max(t0, t1));
+				t0 = mul(sub(load(lowerZ + k), oz), iz); t1 = mul(sub(load(upperZ + k), oz), iz);
+				near = max(near, min(t0, t1)); far = min(far, max(t0, t1));
+
+				Vector hit = select(less(near, precision), far, near);
+				Vector valid = both(both(lessEqual(near, far), lessEqual(precision, hit)),
+									lessEqual(hit, limit));
+				if (mask(valid))
+					closest(valid, hit, k - first, ret, t);
+			}
+			return ret;
 		}
-	};
 
-	#ifdef RAYTRACE_CACHE
-	struct RayCache
-	{
-		std::vector<Point> intersections;
-		std::vector<Color> colors;
+		private:
+			static void closest(SIMD::Vector valid, SIMD::Vector hit, GLuint offset, GLint& ret, Scalar& t)
+			{
+				Scalar lanes[SIMD::LANES] __attribute__((aligned(32)));
+				SIMD::store(lanes, hit);
+				GLuint m = SIMD::mask(valid);
+				for (GLuint l = 0; l < SIMD::LANES; l++)
+					if ((m >> l) & 1)
+						if (lanes[l] < t || (ret < 0 && lanes[l] == t)) {
+							t = lanes[l];
+							ret = offset + l;
+						}
+			}
 	};
-	#endif
-
-	template<GLuint AA, GLuint D, GLuint S, GLuint I>
-	void render(RayData<AA,D,S,I>& data, World const& world)
-	{
-		glMatrixMode(GL_MODELVIEW);
-		glClear (GL_COLOR_BUFFER_BIT);
-		
-		if (data.changed)
-			prerender(data,world);
-		for (GLint i = 0; i < data.viewport[2]; i++)
-			for (GLint j = 0; j < data.viewport[3]; j++)
-				plot(data.buffer[i][j],i,j);
-		glFlush();
-	}
 
-	template<GLuint AA, GLuint D, GLuint S, GLuint I>
-	void prerender(RayData<AA,D,S,I>& data, World const& world)
+	//uniform grid over where the lights reach, so that a hit only looks at
+	//the lights that can light it. A light reaches as far as its intensity,
+	//and no further than where intensity/distance² drops under the
+	//threshold; its radius is added for the samples on its disc. Each cell
+	//lists the lights whose reach overlaps it. Lights reaching across much
+	//of the grid would be listed in most cells, so the grid coarsens until
+	//the lists hold at most BUDGET indices per light.
+	struct LightGrid
 	{
-		static Point end;
-		static Point depth[D];
-		static Ray ray;
-		static Color tmp;
-		static Intersection intersected;
-		#ifdef RAYTRACE_CACHE
-		static RayCache cache;
-		#endif
+		static const GLint RESOLUTION = 32; //cells along the longest side
+		static const GLuint BUDGET = 64;
 
-		#ifndef RAYTRACE_NONPARALLEL
-		#ifdef RAYTRACE_CACHE
-		#pragma omp parallel for schedule(static) private(tmp,ray,intersected,end,depth) shared(cache)
-		#else
-		#pragma omp parallel for schedule(static) private(tmp,ray,intersected,end,depth)
-		#endif
-		#endif
-		for (GLint i = 0; i < data.viewport[2]; i++)
-			for (GLint j = 0; j < data.viewport[3]; j++) {
-				tmp = black;
-				for (GLuint k = 0; k < AA; k++) {
-					gluUnProject(i+Sampling::circle_x[k],data.viewport[3]-j-1+Sampling::circle_y[k],
-								 0, data.modelview, data.projection, data.viewport,
-								 &end.x, &end.y, &end.z);
+		Box bounds;
+		GLint cells[3];
+		Scalar size;
+		std::vector<Scalar> cutoffs; //how far each light reaches from a sample
+		std::vector<GLuint> offsets, indices;
 
-					intersectionPoints(depth,D,data.camera.lookFrom,end,
-									   data.camera.lensHeight,false);
-					for (GLuint r = 0; r < D; r++) {
-						ray = Line(depth[r],end).toRay(data.camera.far);
-						intersected = world.intersect(ray);
-						if (intersected.length > PRECISION)
-							#ifdef RAYTRACE_CACHE
-							tmp += propagateRay(cache,data,world,ray,intersected);
-							#else
-							tmp += propagateRay(data,world,ray,intersected);
-							#endif
-					}
-					tmp *= data.compensation;
+		void build(std::vector<Light> const& lights, Scalar threshold)
+		{
+			bounds = Box();
+			offsets.clear();
+			indices.clear();
+			cutoffs.resize(lights.size());
+			if (lights.empty())
+				return;
+
+			for (GLuint i = 0; i < lights.size(); i++) {
+				cutoffs[i] = minimum(lights[i].intensity, sqrt(lights[i].intensity / threshold));
+				bounds.grow(reach(lights[i], i));
+			}
+			//at resolution 1 there are at most 8 cells, within any budget
+			GLint lower[3], upper[3];
+			for (GLint resolution = RESOLUTION; ; resolution /= 2) {
+				Point d = bounds.upper - bounds.lower;
+				size = maximum(maximum(d.x, d.y), d.z) / resolution;
+				if (!(size > 0))
+					size = 1;
+				cells[0] = cell(d.x) + 1;
+				cells[1] = cell(d.y) + 1;
+				cells[2] = cell(d.z) + 1;
+
+				size_t count = 0;
+				for (GLuint i = 0; i < lights.size(); i++) {
+					range(reach(lights[i], i), lower, upper);
+					count += (size_t)(upper[0] - lower[0] + 1) * (upper[1] - lower[1] + 1) * (upper[2] - lower[2] + 1);
 				}
-				data.buffer[i][j] = tmp;
+				if (count <= BUDGET * lights.size() || resolution == 1)
+					break;
 			}
-		data.changed = false;
-	}
 
-	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+			//counted first, so each cell's lights are in a row
+			offsets.assign(cells[0] * cells[1] * cells[2] + 1, 0);
+			for (GLuint i = 0; i < lights.size(); i++) {
+				range(reach(lights[i], i), lower, upper);
+				for (GLint z = lower[2]; z <= upper[2]; z++)
+					for (GLint y = lower[1]; y <= upper[1]; y++)
+						for (GLint x = lower[0]; x <= upper[0]; x++)
+							offsets[(z * cells[1] + y) * cells[0] + x + 1]++;
+			}
+			for (GLuint c = 1; c < offsets.size(); c++)
+				offsets[c] += offsets[c - 1];
+
+			std::vector<GLuint> next(offsets.begin(), offsets.end() - 1);
+			indices.resize(offsets.back());
+			for (GLuint i = 0; i < lights.size(); i++) {
+				range(reach(lights[i], i), lower, upper);
+				for (GLint z = lower[2]; z <= upper[2]; z++)
+					for (GLint y = lower[1]; y <= upper[1]; y++)
+						for (GLint x = lower[0]; x <= upper[0]; x++)
+							indices[next[(z * cells[1] + y) * cells[0] + x]++] = i;
+			}
+		}
+
+		//the lights that may reach p, as a range of indices
+		void find(Point const& p, GLuint const*& first, GLuint const*& last) const
+		{
+			first = last = 0;
+			if (indices.empty() ||
+				p.x < bounds.lower.x || p.y < bounds.lower.y || p.z < bounds.lower.z ||
+				p.x > bounds.upper.x || p.y > bounds.upper.y || p.z > bounds.upper.z)
+				return;
+			GLuint c = (std::min(cell(p.z - bounds.lower.z), cells[2] - 1) * cells[1] +
+						std::min(cell(p.y - bounds.lower.y), cells[1] - 1)) * cells[0] +
+						std::min(cell(p.x - bounds.lower.x), cells[0] - 1);
+			first = &indices[0] + offsets[c];
+			last = &indices[0] + offsets[c + 1];
+		}
+
+		//whether any sample of light i can reach p
+		bool reaches(Light const& light, GLuint i, Point const& p) const
+		{
+			Point d = p - light.position;
+			Scalar r = cutoffs[i] + light.radius;
+			return d * d < r * r;
+		}
+
+		private:
+			Box reach(Light const& light, GLuint i) const
+			{
+				Scalar r = cutoffs[i] + light.radius;
+				return Box(light.position - Point(r,r,r), light.position + Point(r,r,r));
+			}
+
+			GLint cell(Scalar offset) const { return std::max(0, (GLint)(offset / size)); }
+
+			void range(Box const& box, GLint* lower, GLint* upper) const
+			{
+				lower[0] = std::min(cell(box.lower.x - bounds.lower.x), cells[0] - 1);
+				lower[1] = std::min(cell(box.lower.y - bounds.lower.y), cells[1] - 1);
+				lower[2] = std::min(cell(box.lower.z - bounds.lower.z), cells[2] - 1);
+				upper[0] = std::min(cell(box.upper.x - bounds.lower.x), cells[0] - 1);
+				upper[1] = std::min(cell(box.upper.y - bounds.lower.y), cells[1] - 1);
+				upper[2] = std::min(cell(box.upper.z - bounds.lower.z), cells[2] - 1);
+			}
+	};
+
+	//bounding volume hierarchy over the objects' bounds, built with a binned
+	//surface area heuristic. Children of an inner node are stored side by side
+	//and leaves point to a range of `indices`.
+	struct BVH
+	{
+		static const GLuint BINS = 16;
+		static const GLuint LEAF = 4;
+		static const GLuint DEPTH = 64;
+		static const GLuint STACK = 2*DEPTH;
+
+		struct Node
+		{
+			Box bounds;
+			GLuint first; //left child for inner nodes, first index for leaves
+			GLuint count; //0 for inner nodes
+			GLuint axis; //split axis of inner nodes
+			GLuint spheres, cubes; //a leaf lists its spheres, then its cubes, then the rest
+			GLuint sphereLane, cubeLane; //where the leaf's spheres and cubes start in `primitives`
+		};
+
+		std::vector<Node> nodes;
+		std::vector<GLuint> indices;
+		Primitives primitives;
+
+		void build(std::vector<Object*> const& objects)
+		{
+			std::vector<Box> boxes(objects.size());
+			for (GLuint i = 0; i < objects.size(); i++)
+				boxes[i] = objects[i]->bounds;
+			build(boxes);
+			mirror(objects);
+		}
+
+		//the nodes and indices alone, over any boxes (see TriangleMesh)
+		void build(std::vector<Box> const& boxes)
+		{
+			nodes.clear();
+			indices.resize(boxes.size());
+			if (boxes.empty())
+				return;
+
+			std::vector<Point> centers(boxes.size());
+			for (GLuint i = 0; i < boxes.size(); i++) {
+				indices[i] = i;
+				centers[i] = boxes[i].center();
+			}
+
+			nodes.reserve(2*boxes.size());
+			nodes.push_back(Node());
+			split(0, 0, boxes.size(), 0, boxes, centers);
+		}
+
+		private:
+			template<typename T>
+			struct Is
+			{
+				std::vector<Object*> const& objects;
+
+				Is(std::vector<Object*> const& o):objects(o) { }
+				bool operator()(GLuint i) const { return dynamic_cast<T*>(objects[i]) != 0; }
+			};
+
+			//sorts every leaf by type and copies its spheres and cubes to `primitives`
+			void mirror(std::vector<Object*> const& objects)
+			{
+				GLuint sphereLane = 0, cubeLane = 0;
+				primitives.clear();
+				for (GLuint n = 0; n < nodes.size(); n++) {
+					Node& node = nodes[n];
+					if (node.count == 0)
+						continue;
+
+					std::vector<GLuint>::iterator begin = indices.begin() + node.first;
+					std::vector<GLuint>::iterator end = begin + node.count;
+					std::sort(begin, end);
+					std::vector<GLuint>::iterator cubes = std::stable_partition(begin, end, Is<Sphere>(objects));
+					std::vector<GLuint>::iterator others = std::stable_partition(cubes, end, Is<Cube>(objects));
+
+					node.spheres = cubes - begin;
+					node.cubes = others - cubes;
+					node.sphereLane = sphereLane;
+					node.cubeLane = cubeLane;
+					for (std::vector<GLuint>::iterator i = begin; i != cubes; ++i)
+						primitives.push(*(Sphere*)objects[*i]);
+					for (std::vector<GLuint>::iterator i = cubes; i != others; ++i)
+						primitives.push(*(Cube*)objects[*i]);
+					primitives.align(sphereLane, cubeLane);
+				}
+			}
+
+			struct Below
+			{
+				std::vector<Point> const& centers;
+				GLuint axis;
+				Scalar pivot;
+
+				Below(std::vector<Point> const& c, GLuint a, Scalar p):centers(c),axis(a),pivot(p) { }
+				bool operator()(GLuint i) const { return centers[i][axis] < pivot; }
+			};
+			struct Order
+			{
+				std::vector<Point> const& centers;
+				GLuint axis;
+
+				Order(std::vector<Point> const& c, GLuint a):centers(c),axis(a) { }
+				bool operator()(GLuint a, GLuint b) const { return centers[a][axis] < centers[b][axis]; }
+			};
+
+			void leaf(GLuint node, GLuint first, GLuint count)
+			{
+				nodes[node].first = first;
+				nodes[node].count = count;
+			}
+
+			void split(GLuint node, GLuint first, GLuint count, GLuint depth,
+					   std::vector<Box> const& boxes, std::vector<Point> const& centers)
+			{
+				Box bounds, centroids;
+				for (GLuint i = first; i < first + count; i++) {
+					bounds.grow(boxes[indices[i]]);
+					centroids.grow(centers[indices[i]]);
+				}
+				nodes[node].bounds = bounds;
+
+				if (count <= 1)
+					return leaf(node,first,count);
+
+				Point extent = centroids.upper - centroids.lower;
+				GLuint axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+				Scalar low = centroids.lower[axis], width = extent[axis];
+				if (width <= 0)
+					return leaf(node,first,count);
+
+				GLuint middle = first;
+				if (depth < DEPTH) {
+					Box binBounds[BINS];
+					GLuint binCount[BINS] = { 0 };
+					for (GLuint i = first; i < first + count; i++) {
+						GLuint b = (GLuint)fmin(BINS - 1, (centers[indices[i]][axis] - low) * BINS / width);
+						binBounds[b].grow(boxes[indices[i]]);
+						binCount[b]++;
+					}
+
+					Scalar rightArea[BINS];
+					GLuint rightCount[BINS];
+					Box accumulated;
+					GLuint n = 0;
+					for (GLuint b = BINS - 1; b > 0; b--) {
+						accumulated.grow(binBounds[b]);
+						n += binCount[b];
+						rightArea[b] = accumulated.area();
+						rightCount[b] = n;
+					}
+
+					Scalar best = HUGE_VAL;
+					GLuint cut = 0;
+					accumulated = Box();
+					n = 0;
+					for (GLuint b = 0; b < BINS - 1; b++) {
+						accumulated.grow(binBounds[b]);
+						n += binCount[b];
+						Scalar cost = n * accumulated.area() + rightCount[b+1] * rightArea[b+1];
+						if (n > 0 && rightCount[b+1] > 0 && cost < best) {
+							best = cost;
+							cut = b + 1;
+						}
+					}
+
+					if (count <= LEAF && best >= count * bounds.area())
+						return leaf(node,first,count);
+
+					if (cut > 0)
+						middle = std::partition(indices.begin() + first, indices.begin() + first + count,
+												Below(centers, axis, low + cut * width / BINS)) - indices.begin();
+				}
+
+				if (middle == first || middle == first + count) {
+					middle = first + count/2;
+					std::nth_element(indices.begin() + first, indices.begin() + middle,
+									 indices.begin() + first + count, Order(centers, axis));
+				}
+
+				GLuint left = nodes.size();
+				nodes.push_back(Node());
+				nodes.push_back(Node());
+				nodes[node].first = left;
+				nodes[node].count = 0;
+				nodes[node].axis = axis;
+
+				split(left, first, middle - first, depth + 1, boxes, centers);
+				split(left + 1, middle, first + count - middle, depth + 1, boxes, centers);
+			}
+	};
+
+	//an indexed triangle mesh under its own hierarchy. Vertices, triangles
+	//(three vertex indices each, in leaf order) and nodes are flat arrays,
+	//either owned or mapped straight from a file written by save(), so a
+	//cached mesh loads without parsing or copying anything. Triangles are
+	//two sided and, unlike the convex primitives, may shadow each other.
+	struct TriangleMesh : Object
+	{
+		struct Node
+		{
+			GLfloat lower[3], upper[3];
+			GLuint first; //left child for inner nodes, first triangle for leaves
+			GLuint count; //0 for inner nodes
+		};
+
+		GLuint vertexCount, triangleCount, nodeCount;
+		GLfloat const* vertices;
+		GLuint const* triangles;
+		Node const* nodes;
+
+		//takes the contents of both arrays
+		TriangleMesh(std::vector<GLfloat>& v, std::vector<GLuint>& t)
+		: Object(RayTrace::origin,Point(0,1,0),0,0),mapping(0),mapped(0)
+		{
+			ownedVertices.swap(v);
+			build(t);
+			vertexCount = ownedVertices.size()/3;
+			triangleCount = ownedTriangles.size()/3;
+			nodeCount = ownedNodes.size();
+			vertices = ownedVertices.empty() ? 0 : &ownedVertices[0];
+			triangles = ownedTriangles.empty() ? 0 : &ownedTriangles[0];
+			nodes = ownedNodes.empty() ? 0 : &ownedNodes[0];
+			refresh();
+		}
+		~TriangleMesh()
+		{
+			if (mapping)
+				munmap(mapping, mapped);
+		}
+
+		//the root's bounds, with the bounding sphere as position and scale
+		void refresh()
+		{
+			if (nodeCount == 0) {
+				bounds = Box(position, position);
+				return;
+			}
+			bounds = Box(Point(nodes[0].lower[0],nodes[0].lower[1],nodes[0].lower[2]),
+						 Point(nodes[0].upper[0],nodes[0].upper[1],nodes[0].upper[2]));
+			position = bounds.center();
+			scale = (bounds.upper - position).length();
+		}
+
+		Intersection intersect(Ray const& ray)
+		{
+			Intersection ret;
+			trace(ray, HUGE_VAL, false, ret);
+			return ret;
+		}
+
+		//any triangle short of ray.strength, including those of the mesh the
+		//shaded point is on
+		bool blocks(Ray const& ray, bool)
+		{
+			Intersection ret;
+			return trace(ray, ray.strength, true, ret);
+		}
+
+		//Wavefront OBJ: v and f records (v, v/t, v//n and v/t/n corners,
+		//negative indices counting back), polygons split into fans. Anything
+		//else is skipped. 0 if the file can't be read or has no triangles.
+		static TriangleMesh* obj(const char* path)
+		{
+			FILE* f = fopen(path, "rb");
+			if (!f)
+				return 0;
+			std::vector<char> text;
+			char buffer[1 << 16];
+			size_t n;
+			while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+				text.insert(text.end(), buffer, buffer + n);
+			fclose(f);
+			text.push_back(0);
+
+			std::vector<GLfloat> v;
+			std::vector<GLuint> t;
+			std::vector<GLuint> face;
+			for (char* p = &text[0]; *p; ) {
+				while (*p == ' ' || *p == '\t')
+					p++;
+				if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+					p++;
+					for (GLuint k = 0; k < 3; k++)
+						v.push_back(strtof(p, &p));
+				} else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+					p++;
+					face.clear();
+					for (;;) {
+						char* end;
+						long i = strtol(p, &end, 10);
+						if (end == p)
+							break;
+						p = end;
+						while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+							p++;
+
+						long count = v.size()/3;
+						i = i < 0 ? count + i : i - 1;
+						if (i < 0 || i >= count) {
+							fprintf(stderr, "%s: vertex %ld out of range\n", path, i < 0 ? i : i + 1);
+							return 0;
+						}
+						face.push_back(i);
+					}
+					for (GLuint k = 2; k < face.size(); k++) {
+						t.push_back(face[0]);
+						t.push_back(face[k-1]);
+						t.push_back(face[k]);
+					}
+				}
+				while (*p && *p != '\n')
+					p++;
+				if (*p)
+					p++;
+			}
+
+			if (t.empty())
+				return 0;
+			return new TriangleMesh(v, t);
+		}
+
+		//the arrays as they are in memory after a small header: native
+		//byte order, for the machine that wrote them
+		bool save(const char* path) const
+		{
+			FILE* f = fopen(path, "wb");
+			if (!f)
+				return false;
+			Header header = { { 'R','T','M','E','S','H','1',0 }, vertexCount, triangleCount, nodeCount, sizeof(Node) };
+			bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+					  fwrite(vertices, sizeof(GLfloat), 3*vertexCount, f) == 3*vertexCount &&
+					  fwrite(triangles, sizeof(GLuint), 3*triangleCount, f) == 3*triangleCount &&
+					  fwrite(nodes, sizeof(Node), nodeCount, f) == nodeCount;
+			return fclose(f) == 0 && ok;
+		}
+
+		//a file written by save(), mapped read only. 0 if it isn't one or
+		//it indexes anything it doesn't hold.
+		static TriangleMesh* map(const char* path)
+		{
+			int fd = open(path, O_RDONLY);
+			if (fd < 0)
+				return 0;
+			struct stat s;
+			void* mapping = MAP_FAILED;
+			if (fstat(fd, &s) == 0 && (size_t)s.st_size >= sizeof(Header))
+				mapping = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (mapping == MAP_FAILED)
+				return 0;
+
+			Header const& header = *(Header const*)mapping;
+			size_t size = sizeof(Header) + 3*sizeof(GLfloat)*(size_t)header.vertexCount +
+						  3*sizeof(GLuint)*(size_t)header.triangleCount + sizeof(Node)*(size_t)header.nodeCount;
+			if (memcmp(header.magic, "RTMESH1", 8) || header.node != sizeof(Node) ||
+				header.nodeCount == 0 || size != (size_t)s.st_size || !valid(header, mapping)) {
+				munmap(mapping, s.st_size);
+				return 0;
+			}
+			return new TriangleMesh(header, mapping, s.st_size);
+		}
+
+		//path's cache (path.mesh) when it is newer than path, otherwise
+		//path parsed as OBJ. Only with cache is the parsed mesh written to
+		//path.mesh, next to path, for next time; a directory it can't be
+		//written to just leaves the mesh uncached.
+		static TriangleMesh* load(const char* path, bool cache = false)
+		{
+			std::vector<char> cached(path, path + strlen(path));
+			const char extension[] = ".mesh";
+			cached.insert(cached.end(), extension, extension + sizeof(extension));
+
+			struct stat source, mesh;
+			if (stat(&cached[0], &mesh) == 0 && (stat(path, &source) != 0 || mesh.st_mtime >= source.st_mtime)) {
+				TriangleMesh* ret = map(&cached[0]);
+				if (ret)
+					return ret;
+			}
+
+			TriangleMesh* ret = obj(path);
+			if (ret && cache && !ret->save(&cached[0]))
+				remove(&cached[0]);
+			return ret;
+		}
+
+		private:
+			struct Header
+			{
+				char magic[8];
+				GLuint vertexCount, triangleCount, nodeCount;
+				GLuint node; //sizeof(Node) of the writer
+			};
+
+			std::vector<GLfloat> ownedVertices;
+			std::vector<GLuint> ownedTriangles;
+			std::vector<Node> ownedNodes;
+			void* mapping;
+			size_t mapped;
+
+			TriangleMesh(Header const& header, void* m, size_t size)
+			: Object(RayTrace::origin,Point(0,1,0),0,0),mapping(m),mapped(size)
+			{
+				vertexCount = header.vertexCount;
+				triangleCount = header.triangleCount;
+				nodeCount = header.nodeCount;
+				vertices = (GLfloat const*)((char const*)m + sizeof(Header));
+				triangles = (GLuint const*)(vertices + 3*vertexCount);
+				nodes = (Node const*)(triangles + 3*triangleCount);
+				refresh();
+			}
+			TriangleMesh(TriangleMesh const&);
+			TriangleMesh& operator=(TriangleMesh const&);
+
+			//whether the arrays after header only index what they hold and
+			//trace() can walk the nodes: vertices within vertexCount, leaves
+			//within triangleCount and children after their parent, shallow
+			//enough for trace()'s stack
+			static bool valid(Header const& header, void const* m)
+			{
+				GLuint const* t = (GLuint const*)((char const*)m + sizeof(Header)) + 3*(size_t)header.vertexCount;
+				for (size_t i = 0; i < 3*(size_t)header.triangleCount; i++)
+					if (t[i] >= header.vertexCount)
+						return false;
+
+				Node const* nodes = (Node const*)(t + 3*(size_t)header.triangleCount);
+				std::vector<GLuint> depth(header.nodeCount, 0);
+				for (GLuint n = 0; n < header.nodeCount; n++) {
+					Node const& node = nodes[n];
+					if (node.count > 0) {
+						if ((size_t)node.first + node.count > header.triangleCount)
+							return false;
+					} else {
+						if (node.first <= n || (size_t)node.first + 1 >= header.nodeCount || depth[n] + 1 >= BVH::STACK)
+							return false;
+						for (GLuint k = 0; k < 2; k++)
+							depth[node.first + k] = std::max(depth[node.first + k], depth[n] + 1);
+					}
+				}
+				return true;
+			}
+
+			//the world's builder over the triangles' boxes, its nodes
+			//narrowed to float and the triangles put in leaf order
+			void build(std::vector<GLuint> const& t)
+			{
+				std::vector<Box> boxes(t.size()/3);
+				for (GLuint i = 0; i < boxes.size(); i++)
+					for (GLuint k = 0; k < 3; k++)
+						boxes[i].grow(vertex(&ownedVertices[0], t[3*i+k]));
+
+				BVH bvh;
+				bvh.build(boxes);
+				ownedTriangles.resize(t.size());
+				for (GLuint i = 0; i < bvh.indices.size(); i++)
+					for (GLuint k = 0; k < 3; k++)
+						ownedTriangles[3*i+k] = t[3*bvh.indices[i]+k];
+
+				ownedNodes.resize(bvh.nodes.size());
+				for (GLuint n = 0; n < bvh.nodes.size(); n++) {
+					Node& node = ownedNodes[n];
+					for (GLuint k = 0; k < 3; k++) {
+						node.lower[k] = bvh.nodes[n].bounds.lower[k];
+						node.upper[k] = bvh.nodes[n].bounds.upper[k];
+					}
+					node.first = bvh.nodes[n].first;
+					node.count = bvh.nodes[n].count;
+				}
+			}
+
+			static Point vertex(GLfloat const* v, GLuint i) { return Point(v[3*i],v[3*i+1],v[3*i+2]); }
+
+			//the ray's frame for the watertight test (Woop, Benthin and Wald
+			//2013): z along the largest direction component, then sheared
+			//so the ray is the z axis
+			struct Shear
+			{
+				GLuint x, y, z;
+				Scalar sx, sy, sz;
+
+				Shear(Point const& d)
+				{
+					Scalar ax = fabs(d.x), ay = fabs(d.y), az = fabs(d.z);
+					z = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+					x = (z + 1) % 3;
+					y = (x + 1) % 3;
+					if (d[z] < 0) {
+						GLuint tmp = x; x = y; y = tmp;
+					}
+					sx = d[x]/d[z];
+					sy = d[y]/d[z];
+					sz = 1/d[z];
+				}
+			};
+
+			//the closest triangle before distance (or any, stopping there)
+			//by ordered traversal. The hit's normal faces the ray.
+			bool trace(Ray const& ray, Scalar distance, bool any, Intersection& ret) const
+			{
+				if (nodeCount == 0)
+					return false;
+
+				Shear shear(ray.direction);
+				Point inv = inverse(ray.direction);
+				GLuint stack[BVH::STACK];
+				Scalar nears[BVH::STACK];
+				GLuint top = 0, hit = triangleCount;
+				Scalar near, far;
+
+				if (!overlaps(nodes[0], ray.origin, inv, distance, near))
+					return false;
+				stack[top] = 0;
+				nears[top++] = near;
+
+				while (top > 0) {
+					top--;
+					if (nears[top] > distance)
+						continue;
+
+					Node const& node = nodes[stack[top]];
+					if (node.count > 0) {
+						for (GLuint i = node.first; i < node.first + node.count; i++)
+							if (triangle(i, ray.origin, shear, distance)) {
+								hit = i;
+								if (any)
+									return true;
+							}
+					} else {
+						bool left = overlaps(nodes[node.first], ray.origin, inv, distance, near);
+						bool right = overlaps(nodes[node.first+1], ray.origin, inv, distance, far);
+						if (left && right) {
+							bool swap = far < near;
+							stack[top] = node.first + !swap;
+							nears[top++] = swap ? near : far;
+							stack[top] = node.first + swap;
+							nears[top++] = swap ? far : near;
+						} else if (left) {
+							stack[top] = node.first;
+							nears[top++] = near;
+						} else if (right) {
+							stack[top] = node.first + 1;
+							nears[top++] = far;
+						}
+					}
+				}
+
+				if (hit == triangleCount)
+					return false;
+
+				GLuint const* t = triangles + 3*hit;
+				Point a = vertex(vertices, t[0]), b = vertex(vertices, t[1]), c = vertex(vertices, t[2]);
+				Point normal = ((b - a) % (c - a)).unitary();
+				ret.length = distance;
+				ret.where = ray.origin + distance*ray.direction;
+				ret.normal = normal*ray.direction > 0 ? -1*normal : normal;
+				return true;
+			}
+
+			//p×q in the sheared plane, always evaluated from the lower vertex
+			//index: the two triangles on an edge then get exactly opposite
+			//values even where the products are fused into FMAs
+			template<typename T>
+			static T edge(T px, T py, GLuint p, T qx, T qy, GLuint q)
+			{
+				if (p > q)
+					return -edge(qx, qy, q, px, py, p);
+				return px*qy - py*qx;
+			}
+
+			static bool overlaps(Node const& node, Point const& origin, Point const& inv, Scalar distance, Scalar& near)
+			{
+				return Box(Point(node.lower[0],node.lower[1],node.lower[2]),
+						   Point(node.upper[0],node.upper[1],node.upper[2])).intersect(origin, inv, distance, near);
+			}
+
+			//triangle i against the sheared ray, narrowing distance on a hit.
+			//Edges are tested in the ray's frame with no epsilon, so a ray
+			//through a shared edge or vertex always hits one of its triangles.
+			bool triangle(GLuint i, Point const& origin, Shear const& shear, Scalar& distance) const
+			{
+				GLuint const* t = triangles + 3*i;
+				Point a = vertex(vertices, t[0]) - origin;
+				Point b = vertex(vertices, t[1]) - origin;
+				Point c = vertex(vertices, t[2]) - origin;
+
+				Scalar ax = a[shear.x] - shear.sx*a[shear.z], ay = a[shear.y] - shear.sy*a[shear.z];
+				Scalar bx = b[shear.x] - shear.sx*b[shear.z], by = b[shear.y] - shear.sy*b[shear.z];
+				Scalar cx = c[shear.x] - shear.sx*c[shear.z], cy = c[shear.y] - shear.sy*c[shear.z];
+
+				Scalar U = edge<Scalar>(cx, cy, t[2], bx, by, t[1]);
+				Scalar V = edge<Scalar>(ax, ay, t[0], cx, cy, t[2]);
+				Scalar W = edge<Scalar>(bx, by, t[1], ax, ay, t[0]);
+				//exactly on an edge: settle the sign in double
+				if (sizeof(Scalar) < sizeof(GLdouble) && (U == 0 || V == 0 || W == 0)) {
+					U = edge<GLdouble>(cx, cy, t[2], bx, by, t[1]);
+					V = edge<GLdouble>(ax, ay, t[0], cx, cy, t[2]);
+					W = edge<GLdouble>(bx, by, t[1], ax, ay, t[0]);
+				}
+				if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+					return false;
+
+				Scalar det = U + V + W;
+				if (det == 0)
+					return false;
+
+				Scalar T = U*shear.sz*a[shear.z] + V*shear.sz*b[shear.z] + W*shear.sz*c[shear.z];
+				Scalar length = T/det;
+				if (length <= PRECISION || length >= distance)
+					return false;
+
+				distance = length;
+				return true;
+			}
+	};
+
+	//a small group of coherent rays that walk the hierarchy together. Rays
+	//are kept as structure of arrays so a box is tested against several of
+	//them per instruction.
+	struct Packet
+	{
+		static const GLuint SIZE = 16;
+
+		Scalar originX[SIZE] __attribute__((aligned(32)));
+		Scalar originY[SIZE] __attribute__((aligned(32)));
+		Scalar originZ[SIZE] __attribute__((aligned(32)));
+		Scalar inverseX[SIZE] __attribute__((aligned(32)));
+		Scalar inverseY[SIZE] __attribute__((aligned(32)));
+		Scalar inverseZ[SIZE] __attribute__((aligned(32)));
+		Scalar distance[SIZE] __attribute__((aligned(32)));
+
+		Ray rays[SIZE];
+		Point inverses[SIZE];
+		Intersection hits[SIZE];
+		GLuint size;
+
+		Packet():size(0) { }
+
+		void clear() { size = 0; }
+		void add(Ray const& ray)
+		{
+			rays[size] = ray;
+			inverses[size] = inverse(ray.direction);
+			hits[size] = Intersection();
+			size++;
+		}
+
+		//copies the rays to the lanes, repeating the first one up to a whole vector
+		void pack()
+		{
+			for (GLuint i = 0; i < SIZE; i++) {
+				GLuint r = i < size ? i : 0;
+				originX[i] = rays[r].origin.x;
+				originY[i] = rays[r].origin.y;
+				originZ[i] = rays[r].origin.z;
+				inverseX[i] = inverses[r].x;
+				inverseY[i] = inverses[r].y;
+				inverseZ[i] = inverses[r].z;
+				distance[i] = rays[r].strength;
+			}
+		}
+
+		//bit mask of the rays whose remaining segment overlaps the box
+		GLuint overlaps(Box const& box) const
+		{
+			using namespace SIMD;
+			Vector lx = set(box.lower.x), ly = set(box.lower.y), lz = set(box.lower.z);
+			Vector ux = set(box.upper.x), uy = set(box.upper.y), uz = set(box.upper.z);
+			Vector zero = set(0);
+
+			GLuint ret = 0;
+			for (GLuint k = 0; k < size; k += LANES) {
+				Vector ox = load(originX + k), ix = load(inverseX + k);
+				Vector t0 = mul(sub(lx, ox), ix), t1 = mul(sub(ux, ox), ix);
+				Vector near = min(t0, t1), far = max(t0, t1);
+
+				Vector oy = load(originY + k), iy = load(inverseY + k);
+				t0 = mul(sub(ly, oy), iy); t1 = mul(sub(uy, oy), iy);
+				near = max(near, min(t0, t1)); far = min(far, max(t0, t1));
+
+				Vector oz = load(originZ + k), iz = load(inverseZ + k);
+				t0 = mul(sub(lz, oz), iz); t1 = mul(sub(uz, oz), iz);
+				near = max(near, min(t0, t1)); far = min(far, max(t0, t1));
+
+				ret |= mask(both(lessEqual(max(near, zero), far), lessEqual(near, load(distance + k)))) << k;
+			}
+			return ret & ((1u << size) - 1);
+		}
+	};
+
+	struct World {
+		std::vector<Object*> objects;
+		std::vector<Material> materials;
+		std::vector<Light> lights;
+		Scalar ambientIntensity;
+
+		//light under this intensity/distance² is left out (see LightGrid)
+		Scalar threshold;
+
+		mutable BVH bvh;
+		mutable LightGrid grid;
+		mutable bool dirty;
+
+		World(Scalar light):ambientIntensity(light),threshold(0.001),dirty(true) { }
+		void add(Light const& l)
+		{
+			lights.push_back(l);
+			dirty = true;
+		}
+		void add(Object* const& obj, Material const& m)
+		{
+			obj->refresh();
+			objects.push_back(obj);
+			dirty = true;
+			for (GLuint i = 0; i < materials.size(); i++)
+				if (materials[i] == m) {
+					objects[objects.size()-1]->material = i;
+					return;
+				}
+			materials.push_back(m);
+			objects[objects.size()-1]->material = materials.size() - 1;
+		}
+
+		//rebuilds the hierarchy and the light grid if objects or lights
+		//were added since the last build
+		void refresh() const
+		{
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp critical (RayTraceWorld)
+			#endif
+			if (dirty) {
+				bvh.build(objects);
+				grid.build(lights, threshold);
+				dirty = false;
+			}
+		}
+
+		Intersection intersect(Ray const& ray) const
+		{
+			if (dirty)
+				refresh();
+
+			Intersection ret;
+			Scalar distance = ray.strength;
+			if (bvh.nodes.empty())
+				return ret;
+
+			Point inv = inverse(ray.direction);
+			Deferred deferred;
+			GLuint stack[BVH::STACK];
+			Scalar nears[BVH::STACK];
+			GLuint top = 0;
+			Scalar near, far;
+
+			if (!bvh.nodes[0].bounds.intersect(ray.origin, inv, distance, near))
+				return ret;
+			stack[top] = 0;
+			nears[top++] = near;
+
+			while (top > 0) {
+				top--;
+				if (nears[top] > distance)
+					continue;
+
+				BVH::Node const& node = bvh.nodes[stack[top]];
+				if (node.count > 0)
+					leaf(node, ray, inv, distance, ret, deferred);
+				else {
+					bool left = bvh.nodes[node.first].bounds.intersect(ray.origin, inv, distance, near);
+					bool right = bvh.nodes[node.first+1].bounds.intersect(ray.origin, inv, distance, far);
+					if (left && right) {
+						bool swap = far < near;
+						stack[top] = node.first + !swap;
+						nears[top++] = swap ? near : far;
+						stack[top] = node.first + swap;
+						nears[top++] = swap ? far : near;
+					} else if (left) {
+						stack[top] = node.first;
+						nears[top++] = near;
+					} else if (right) {
+						stack[top] = node.first + 1;
+						nears[top++] = far;
+					}
+				}
+			}
+
+			resolve(ray, deferred, ret);
+			return ret;
+		}
+
+		//traces the whole packet, visiting a node when any of its rays can
+		//still hit something in it. Children are ordered by the direction of
+		//the first ray still active.
+		void intersect(Packet& packet) const
+		{
+			if (dirty)
+				refresh();
+			if (bvh.nodes.empty() || packet.size == 0)
+				return;
+
+			packet.pack();
+			Deferred deferred[Packet::SIZE];
+			GLuint stack[BVH::STACK];
+			GLuint top = 0;
+			stack[top++] = 0;
+
+			while (top > 0) {
+				BVH::Node const& node = bvh.nodes[stack[--top]];
+				GLuint active = packet.overlaps(node.bounds);
+				if (!active)
+					continue;
+
+				if (node.count > 0) {
+					for (GLuint r = 0; r < packet.size; r++)
+						if ((active >> r) & 1)
+							leaf(node, packet.rays[r], packet.inverses[r], packet.distance[r], packet.hits[r], deferred[r]);
+				} else {
+					GLuint r = __builtin_ctz(active);
+					bool swap = packet.rays[r].direction[node.axis] < 0;
+					stack[top++] = node.first + !swap;
+					stack[top++] = node.first + swap;
+				}
+			}
+
+			for (GLuint r = 0; r < packet.size; r++)
+				resolve(packet.rays[r], deferred[r], packet.hits[r]);
+		}
+
+		//whether anything but object `index` lies between origin and target,
+		//stopping at the first blocker found. Nothing beyond the hit itself
+		//is computed, and the target's own object only occludes it if it
+		//says so (Object::blocks): on the convex primitives that only
+		//happens when it faces away from origin.
+		bool occluded(Point const& origin, Point const& target, GLuint index) const
+		{
+			if (dirty)
+				refresh();
+			if (bvh.nodes.empty())
+				return false;
+
+			Point direction = target - origin;
+			Scalar distance = direction.length() - PRECISION;
+			Ray ray(origin, direction.unitary(), distance);
+			Point inv = inverse(ray.direction);
+			GLuint stack[BVH::STACK];
+			GLuint top = 0;
+			Scalar near;
+			stack[top++] = 0;
+
+			while (top > 0) {
+				BVH::Node const& node = bvh.nodes[stack[--top]];
+				if (!node.bounds.intersect(ray.origin, inv, distance, near))
+					continue;
+
+				if (node.count > 0) {
+					if (blocks(node, ray, inv, index))
+						return true;
+				} else {
+					stack[top++] = node.first;
+					stack[top++] = node.first + 1;
+				}
+			}
+			return false;
+		}
+
+		//any hit in the leaf closer than ray.strength. The kernels only
+		//report the closest lane, so a leaf whose closest one is the
+		//excluded object is checked again one object at a time.
+		bool blocks(BVH::Node const& node, Ray const& ray, Point const& inv, GLuint index) const
+		{
+			GLint k;
+			Scalar t;
+			GLuint spheres = node.first, cubes = spheres + node.spheres, others = cubes + node.cubes;
+			if (node.spheres > 0 &&
+				(k = bvh.primitives.spheres(node.sphereLane, node.spheres, ray, ray.strength, t)) >= 0 &&
+				(bvh.indices[spheres + k] != index || spheresBlock(node, ray, index)))
+				return true;
+			if (node.cubes > 0 &&
+				(k = bvh.primitives.cubes(node.cubeLane, node.cubes, ray, inv, ray.strength, t)) >= 0 &&
+				(bvh.indices[cubes + k] != index || cubesBlock(node, ray, index)))
+				return true;
+			for (GLuint i = others; i < node.first + node.count; i++)
+				if (objects[bvh.indices[i]]->blocks(ray, bvh.indices[i] == index))
+					return true;
+			return false;
+		}
+
+		//the leaf's spheres or cubes but object `index`, one at a time
+		bool spheresBlock(BVH::Node const& node, Ray const& ray, GLuint index) const
+		{
+			for (GLuint k = 0; k < node.spheres; k++)
+				if (bvh.indices[node.first + k] != index) {
+					Scalar t = bvh.primitives.sphereDistance(node.sphereLane + k, ray);
+					if (t >= 0 && t < ray.strength)
+						return true;
+				}
+			return false;
+		}
+		bool cubesBlock(BVH::Node const& node, Ray const& ray, GLuint index) const
+		{
+			for (GLuint k = 0; k < node.cubes; k++)
+				if (bvh.indices[node.first + node.spheres + k] != index) {
+					Scalar t = bvh.primitives.cubeDistance(node.cubeLane + k, ray);
+					if (t >= 0 && t < ray.strength)
+						return true;
+				}
+			return false;
+		}
+
+		//the closest hit while tracing, when it is one of the leaves' spheres
+		//or cubes: only its distance and index are kept in the intersection
+		//until the ray is done, and the lane tells where to find the rest
+		struct Deferred
+		{
+			enum Kind { none, sphere, cube } kind;
+			GLuint lane;
+			Deferred():kind(none),lane(0) { }
+		};
+
+		//the kernels pick the closest sphere and cube of the leaf by distance
+		//alone; their hits are filled in by resolve() once the whole ray is
+		//traced, so hits later beaten cost nothing more. Anything else goes
+		//through Object.
+		void leaf(BVH::Node const& node, Ray const& ray, Point const& inv,
+				  Scalar& distance, Intersection& ret, Deferred& deferred) const
+		{
+			GLint k;
+			Scalar t;
+			if (node.spheres > 0 &&
+				(k = bvh.primitives.spheres(node.sphereLane, node.spheres, ray, distance, t)) >= 0 &&
+				closest(bvh.indices[node.first + k], t, distance, ret)) {
+				deferred.kind = Deferred::sphere;
+				deferred.lane = node.sphereLane + k;
+			}
+			if (node.cubes > 0 &&
+				(k = bvh.primitives.cubes(node.cubeLane, node.cubes, ray, inv, distance, t)) >= 0 &&
+				closest(bvh.indices[node.first + node.spheres + k], t, distance, ret)) {
+				deferred.kind = Deferred::cube;
+				deferred.lane = node.cubeLane + k;
+			}
+			for (GLuint i = node.first + node.spheres + node.cubes; i < node.first + node.count; i++) {
+				Intersection tmp = objects[bvh.indices[i]]->intersect(ray);
+				if (tmp.length >= 0 && closest(bvh.indices[i], tmp.length, distance, ret)) {
+					GLuint index = ret.index;
+					ret = tmp;
+					ret.index = index;
+					deferred.kind = Deferred::none;
+				}
+			}
+		}
+
+		//whether a hit on object i at length beats the closest so far,
+		//which it then replaces but for where and normal
+		bool closest(GLuint i, Scalar length, Scalar& distance, Intersection& ret) const
+		{
+			//ties go to the lowest index, like the linear scan
+			if (length < distance ||
+				(length == distance && ret.length >= 0 && i < ret.index)) {
+				distance = length;
+				ret.length = length;
+				ret.index = i;
+				return true;
+			}
+			return false;
+		}
+
+		//fills in a deferred hit from the copies of its sphere or cube
+		void resolve(Ray const& ray, Deferred const& deferred, Intersection& ret) const
+		{
+			GLuint index = ret.index;
+			if (deferred.kind == Deferred::sphere)
+				ret = bvh.primitives.sphere(deferred.lane, ray);
+			else if (deferred.kind == Deferred::cube)
+				ret = bvh.primitives.cube(deferred.lane, ray);
+			ret.index = index;
+		}
+
+		//brute force reference for the hierarchy
+		Intersection intersectLinear(Ray const& ray) const
+		{
+			Intersection ret, tmp;
+			Scalar distance = ray.strength;
+			for(GLuint i = 0; i < objects.size(); i++) {
+				tmp = objects[i]->intersect(ray);
+				if (tmp.length >= 0)
+					if (tmp.length < distance) {
+						distance = tmp.length;
+						ret = tmp;
+						ret.index = i;
+					}
+			}
+
+			return ret;
+		}
+	};
+
+	//an affine map as a row major 3x4 matrix: the linear part, then the
+	//translation as the last column
+	struct Transform
+	{
+		Scalar m[12];
+
+		Point operator()(Point const& p) const { return linear(p) + Point(m[3],m[7],m[11]); }
+		Point linear(Point const& p) const
+		{
+			return Point(m[0]*p.x + m[1]*p.y + m[2]*p.z,
+						 m[4]*p.x + m[5]*p.y + m[6]*p.z,
+						 m[8]*p.x + m[9]*p.y + m[10]*p.z);
+		}
+		//the transposed linear part, which takes normals back through an inverse
+		Point transposed(Point const& p) const
+		{
+			return Point(m[0]*p.x + m[4]*p.y + m[8]*p.z,
+						 m[1]*p.x + m[5]*p.y + m[9]*p.z,
+						 m[2]*p.x + m[6]*p.y + m[10]*p.z);
+		}
+
+		Transform inverse() const
+		{
+			Transform ret;
+			Scalar a = m[5]*m[10] - m[6]*m[9], b = m[6]*m[8] - m[4]*m[10], c = m[4]*m[9] - m[5]*m[8];
+			Scalar det = m[0]*a + m[1]*b + m[2]*c;
+			ret.m[0] = a/det;
+			ret.m[1] = (m[2]*m[9] - m[1]*m[10])/det;
+			ret.m[2] = (m[1]*m[6] - m[2]*m[5])/det;
+			ret.m[4] = b/det;
+			ret.m[5] = (m[0]*m[10] - m[2]*m[8])/det;
+			ret.m[6] = (m[2]*m[4] - m[0]*m[6])/det;
+			ret.m[8] = c/det;
+			ret.m[9] = (m[1]*m[8] - m[0]*m[9])/det;
+			ret.m[10] = (m[0]*m[5] - m[1]*m[4])/det;
+			Point t = ret.linear(Point(m[3],m[7],m[11]));
+			ret.m[3] = -t.x;
+			ret.m[7] = -t.y;
+			ret.m[11] = -t.z;
+			return ret;
+		}
+	};
+
+	//one placement of shared geometry, which is scaled by scale, turned so
+	//its y axis points along up and moved to position. Rays are taken into
+	//the geometry's space to be intersected, so any number of instances
+	//cost one geometry and a pair of matrices each. The geometry is not
+	//owned, nor added to the world, and its material is the instance's.
+	struct Instance : Object
+	{
+		Object* geometry;
+		Transform toWorld, toLocal;
+
+		Instance(Object* g, Point pos, Point up, Scalar scale)
+		: Object(pos,up,0,scale),geometry(g) { refresh(); }
+
+		void refresh()
+		{
+			//y along up, and x and z as close to the world's as up allows
+			Point y = up;
+			y = y.unitary();
+			Point z = Point(1,0,0) % y;
+			if (z*z < 0.01)
+				z = y % Point(0,0,1);
+			z = z.unitary();
+			Point x = y % z;
+
+			Scalar m[12] = { scale*x.x, scale*y.x, scale*z.x, position.x,
+							 scale*x.y, scale*y.y, scale*z.y, position.y,
+							 scale*x.z, scale*y.z, scale*z.z, position.z };
+			std::copy(m, m + 12, toWorld.m);
+			toLocal = toWorld.inverse();
+
+			geometry->refresh();
+			Box const& b = geometry->bounds;
+			bounds = Box();
+			for (GLuint k = 0; k < 8; k++)
+				bounds.grow(toWorld(Point(k & 1 ? b.upper.x : b.lower.x,
+										  k & 2 ? b.upper.y : b.lower.y,
+										  k & 4 ? b.upper.z : b.lower.z)));
+		}
+
+		Intersection intersect(Ray const& ray)
+		{
+			Scalar stretch;
+			Ray local = enter(ray, stretch);
+			Intersection ret = geometry->intersect(local);
+			if (ret.length >= 0) {
+				ret.length /= stretch;
+				ret.where = ray.origin + ret.length*ray.direction;
+				ret.normal = toLocal.transposed(ret.normal).unitary();
+			}
+			return ret;
+		}
+
+		bool blocks(Ray const& ray, bool self)
+		{
+			Scalar stretch;
+			return geometry->blocks(enter(ray, stretch), self);
+		}
+
+		private:
+			//the ray in the geometry's space, still of unit direction, and
+			//how much longer distances are there
+			Ray enter(Ray const& ray, Scalar& stretch) const
+			{
+				Point direction = toLocal.linear(ray.direction);
+				stretch = direction.length();
+				return Ray(toLocal(ray.origin), direction/stretch, ray.strength*stretch);
+			}
+	};
+
+	//objects shared as one geometry, typically by instances, under their
+	//own hierarchy. Parts must be added before the group is placed.
+	struct Group : Object
+	{
+		World parts;
+
+		Group():Object(RayTrace::origin,Point(0,1,0),0,0),parts(0) { }
+
+		void add(Object* part)
+		{
+			part->refresh();
+			parts.objects.push_back(part);
+			parts.dirty = true;
+		}
+
+		//the parts' bounds, with the bounding sphere as position and scale
+		void refresh()
+		{
+			parts.refresh();
+			if (parts.bvh.nodes.empty()) {
+				bounds = Box(position, position);
+				return;
+			}
+			bounds = parts.bvh.nodes[0].bounds;
+			position = bounds.center();
+			scale = (bounds.upper - position).length();
+		}
+
+		//every hit is closer than the far side of the bounding sphere
+		Intersection intersect(Ray const& ray)
+		{
+			return parts.intersect(Ray(ray.origin, ray.direction, Line(ray.origin, position).length() + scale));
+		}
+
+		//parts may shadow each other
+		bool blocks(Ray const& ray, bool)
+		{
+			return parts.occluded(ray.origin, ray.origin + (ray.strength + PRECISION)*ray.direction, parts.objects.size());
+		}
+	};
+
+	//a color channel as an 8 bit value, clamped the way glColor3d does
+	inline GLubyte quantize(Scalar c)
+	{
+		return (GLubyte)(fmin(fmax(c, 0), 1) * 255 + 0.5);
+	}
+
+	//wall clock seconds
+	inline GLdouble now()
+	{
+		timeval t;
+		gettimeofday(&t, 0);
+		return t.tv_sec + t.tv_usec * 1e-6;
+	}
+
+	//the OpenMP thread running the caller, and how many there can be
+	inline GLuint thread()
+	{
+		#ifdef _OPENMP
+		return omp_get_thread_num();
+		#else
+		return 0;
+		#endif
+	}
+
+	inline GLuint team()
+	{
+		#ifdef _OPENMP
+		return omp_get_num_threads();
+		#else
+		return 1;
+		#endif
+	}
+
+	inline GLuint threads()
+	{
+		#ifdef _OPENMP
+		return std::max(omp_get_max_threads(), omp_get_num_procs());
+		#else
+		return 1;
+		#endif
+	}
+
+	//rays traced by one thread, padded to a cache line so that threads
+	//never write to the same one
+	struct Statistics
+	{
+		unsigned long long primary, secondary, shadow;
+		char padding[64 - 3 * sizeof(unsigned long long)];
+
+		Statistics():primary(0),secondary(0),shadow(0) { }
+
+		Statistics& operator+=(Statistics const& s)
+		{
+			primary += s.primary;
+			secondary += s.secondary;
+			shadow += s.shadow;
+			return *this;
+		}
+	};
+
+	#ifdef RAYTRACE_CACHE
+	//colors already shaded at a hit, keyed by the object and the hit point
+	//snapped to a grid of the given step. The entries live in fixed size
+	//sets of WAYS slots spread over SHARDS shards: a full set evicts its
+	//entries in turn, so the cache never outgrows the memory it was given.
+	//Writers lock their shard; readers never lock, they check a version
+	//number around the copy and count a miss if a writer got in between.
+	struct RayCache
+	{
+		static const GLuint SHARDS = 64;
+		static const GLuint WAYS = 8;
+
+		struct Entry
+		{
+			volatile GLuint version;
+			unsigned long long key;
+			Color color;
+
+			Entry():version(0),key(0) { }
+		};
+
+		struct Shard
+		{
+			volatile GLint lock;
+			GLuint clock;
+			std::vector<Entry> entries;
+
+			Shard():lock(0),clock(0) { }
+		};
+
+		//per thread, so that counting is free of contention
+		struct Counters
+		{
+			unsigned long long hits, misses, insertions, evictions;
+			char padding[64 - 4 * sizeof(unsigned long long)];
+
+			Counters():hits(0),misses(0),insertions(0),evictions(0) { }
+		};
+
+		Scalar step;
+		std::vector<Shard> shards;
+		std::vector<Counters> counters;
+
+		RayCache(size_t bytes = 64 << 20, Scalar step = 0.001)
+		: step(step),counters(threads())
+		{
+			resize(bytes);
+		}
+
+		//drops every entry and sets the memory cap
+		void resize(size_t bytes)
+		{
+			GLuint sets = std::max<size_t>(1, bytes / (SHARDS * WAYS * sizeof(Entry)));
+			shards.assign(SHARDS, Shard());
+			for (GLuint i = 0; i < SHARDS; i++)
+				shards[i].entries.resize(sets * WAYS);
+			counters.assign(threads(), Counters());
+		}
+
+		bool find(Point const& where, GLuint index, Color& color)
+		{
+			unsigned long long k = key(where, index);
+			Entry* set = find(k);
+			for (GLuint i = 0; i < WAYS; i++) {
+				GLuint version = set[i].version;
+				__sync_synchronize();
+				if (version % 2 == 0 && set[i].key == k) {
+					Color tmp = set[i].color;
+					__sync_synchronize();
+					if (set[i].version == version) {
+						color = tmp;
+						counters[thread()].hits++;
+						return true;
+					}
+				}
+			}
+			counters[thread()].misses++;
+			return false;
+		}
+
+		void insert(Point const& where, GLuint index, Color const& color)
+		{
+			unsigned long long k = key(where, index);
+			Shard& shard = shards[k % SHARDS];
+			Entry* set = find(k);
+
+			while (__sync_lock_test_and_set(&shard.lock, 1))
+				;
+			GLint slot = -1;
+			for (GLuint i = 0; i < WAYS && slot < 0; i++)
+				if (set[i].key == k || set[i].key == 0)
+					slot = i;
+			if (slot < 0) {
+				slot = shard.clock++ % WAYS;
+				counters[thread()].evictions++;
+			}
+
+			Entry& e = set[slot];
+			e.version++;
+			__sync_synchronize();
+			e.key = k;
+			e.color = color;
+			__sync_synchronize();
+			e.version++;
+			__sync_lock_release(&shard.lock);
+
+			counters[thread()].insertions++;
+		}
+
+		Counters total() const
+		{
+			Counters ret;
+			for (GLuint i = 0; i < counters.size(); i++) {
+				ret.hits += counters[i].hits;
+				ret.misses += counters[i].misses;
+				ret.insertions += counters[i].insertions;
+				ret.evictions += counters[i].evictions;
+			}
+			return ret;
+		}
+
+	private:
+		unsigned long long key(Point const& where, GLuint index) const
+		{
+			unsigned long long ret = mix(index);
+			ret = mix(ret ^ (unsigned long long)(long long)floor(where.x / step));
+			ret = mix(ret ^ (unsigned long long)(long long)floor(where.y / step));
+			ret = mix(ret ^ (unsigned long long)(long long)floor(where.z / step));
+			return ret ? ret : 1;
+		}
+
+		//the set a key belongs to: the low bits pick the shard, the rest the set
+		Entry* find(unsigned long long key)
+		{
+			std::vector<Entry>& entries = shards[key % SHARDS].entries;
+			return &entries[(key / SHARDS) % (entries.size() / WAYS) * WAYS];
+		}
+	};
+	#endif
+
+	//the objects a hit takes interreflections from. Objects whose bounding
+	//sphere (every point intersectionPoints aims at is within scale of the
+	//position) lies under the tangent plane can't light it and are skipped.
+	//If more than limit are left, they are picked by systematic sampling
+	//with odds proportional to the solid angle they cover, capped at one,
+	//and next() gives the inverse odds to weight each one's sum with.
+	struct Interreflections
+	{
+		Interreflections(World const& world, Intersection const& hit, GLuint limit)
+		:world(world),hit(hit),limit(limit),count(0),total(0),scale(1),offset(0),sum(0),object(0)
+		{
+			for (GLuint i = 0; i < world.objects.size(); i++) {
+				Scalar w = weight(i);
+				if (w > 0) {
+					count++;
+					total += w;
+				}
+			}
+			if (sampled())
+				scale = limit / total;
+		}
+
+		//whether some objects are left out, so start needs a random number
+		bool sampled() const { return count > limit; }
+
+		void start(Scalar u) { offset = u; }
+
+		bool next(GLuint& i, Scalar& compensation)
+		{
+			while (object < world.objects.size()) {
+				i = object++;
+				Scalar w = weight(i);
+				if (w <= 0)
+					continue;
+				if (!sampled()) {
+					compensation = 1;
+					return true;
+				}
+
+				//picked if a point of the evenly spaced comb falls in its stretch
+				Scalar p = minimum(1, scale * w);
+				Scalar before = sum;
+				sum += p;
+				if (floor(sum - offset) > floor(before - offset)) {
+					compensation = 1 / p;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		private:
+			World const& world;
+			Intersection const& hit;
+			GLuint limit, count;
+			Scalar total, scale, offset, sum;
+			GLuint object;
+
+			//solid angle of an object's bounding sphere, 0 if it is culled
+			Scalar weight(GLuint i) const
+			{
+				if (i == hit.index)
+					return 0;
+				Object const& o = *world.objects[i];
+				Point to = o.position - hit.where;
+				if (hit.normal * to < -o.scale)
+					return 0;
+				Scalar d2 = to * to, r2 = o.scale * o.scale;
+				if (d2 <= r2)
+					return 2 * M_PI;
+				return 2 * M_PI * (1 - sqrt(1 - r2 / d2));
+			}
+	};
+
+	//a std::vector allocator handing out cache line aligned storage, which
+	//std::allocator does not for types aligned beyond what malloc gives
+	template<typename T>
+	struct LineAllocator
+	{
+		typedef T value_type;
+		typedef T* pointer;
+		typedef T const* const_pointer;
+		typedef T& reference;
+		typedef T const& const_reference;
+		typedef size_t size_type;
+		typedef ptrdiff_t difference_type;
+		template<typename U> struct rebind { typedef LineAllocator<U> other; };
+
+		LineAllocator() { }
+		template<typename U> LineAllocator(LineAllocator<U> const&) { }
+
+		pointer address(reference x) const { return &x; }
+		const_pointer address(const_reference x) const { return &x; }
+		size_type max_size() const { return (size_t)-1 / sizeof(T); }
+
+		pointer allocate(size_type n, void const* = 0)
+		{
+			void* ret = 0;
+			if (posix_memalign(&ret, 64, n * sizeof(T)))
+				throw std::bad_alloc();
+			return (pointer)ret;
+		}
+		void deallocate(pointer p, size_type) { free(p); }
+		void construct(pointer p, const_reference x) { new((void*)p) T(x); }
+		void destroy(pointer p) { p->~T(); }
+
+		template<typename U> bool operator==(LineAllocator<U> const&) const { return true; }
+		template<typename U> bool operator!=(LineAllocator<U> const&) const { return false; }
+	};
+
+	//a block of pixels a thread renders in one go
+	struct Tile
+	{
+		GLint x, y, width, height;
+	};
+
+	//hands out the tiles of an image: each thread starts on its own stretch
+	//of the tile order and, once done with it, steals from the back of the
+	//others, so threads that drew empty sky help with the expensive parts
+	struct Scheduler
+	{
+		enum Order { rows, morton, hilbert };
+
+		//the tiles a thread still owns, [head, tail), and how it spent the frame
+		struct Counters
+		{
+			GLuint head, tail;
+			volatile GLint lock;
+			GLuint tiles, stolen;
+			GLdouble busy, idle;
+		};
+
+		//one cache line (or more) per queue, so threads taking tiles from
+		//their own queue don't invalidate their neighbours'
+		struct Queue : Counters
+		{
+			char padding[64 - sizeof(Counters) % 64];
+
+			Queue()
+			{
+				head = tail = tiles = stolen = 0;
+				lock = 0;
+				busy = idle = 0;
+			}
+		} __attribute__((aligned(64)));
+		typedef char QueueFillsLines[sizeof(Queue) % 64 == 0 ? 1 : -1];
+
+		std::vector<Tile> tiles;
+		std::vector<Queue, LineAllocator<Queue> > queues;
+
+		//what the tiles were cut for
+		GLint width, height, size;
+		Order order;
+
+		Scheduler():width(0),height(0),size(0),order(rows) { queues.reserve(RayTrace::threads()); }
+
+		void plan(GLint width, GLint height, GLint size, Order order)
+		{
+			this->width = width;
+			this->height = height;
+			this->size = size;
+			this->order = order;
+
+			GLint columns = (width + size - 1) / size, lines = (height + size - 1) / size;
+			std::vector<std::pair<GLuint,GLuint> > keys;
+			std::vector<Tile> all;
+			for (GLint y = 0; y < lines; y++)
+				for (GLint x = 0; x < columns; x++) {
+					Tile t = { x * size, y * size, std::min(size, width - x * size),
+							   std::min(size, height - y * size) };
+					keys.push_back(std::make_pair(key(x, y, columns, lines, order), (GLuint)all.size()));
+					all.push_back(t);
+				}
+			std::sort(keys.begin(), keys.end());
+
+			tiles.resize(all.size());
+			for (GLuint i = 0; i < keys.size(); i++)
+				tiles[i] = all[keys[i].second];
+		}
+
+		//hands the tiles out again for a new frame, only cutting them anew
+		//if the image, the tile size or the order changed, so that a frame
+		//allocates nothing
+		void start(GLint width, GLint height, GLint size, Order order, GLuint threads)
+		{
+			if (width != this->width || height != this->height || size != this->size || order != this->order)
+				plan(width, height, size, order);
+
+			queues.assign(threads, Queue());
+			deal(threads);
+		}
+
+		//gives each thread its stretch of the tiles again, within a frame
+		void deal(GLuint threads)
+		{
+			for (GLuint t = 0; t < threads; t++) {
+				queues[t].head = tiles.size() * t / threads;
+				queues[t].tail = tiles.size() * (t + 1) / threads;
+			}
+		}
+
+		bool next(GLuint thread, Tile& tile)
+		{
+			Queue& own = queues[thread];
+			if (pop(own, tile, false)) {
+				own.tiles++;
+				return true;
+			}
+			for (GLuint k = 1; k < queues.size(); k++)
+				if (pop(queues[(thread + k) % queues.size()], tile, true)) {
+					own.tiles++;
+					own.stolen++;
+					return true;
+				}
+			return false;
+		}
+
+	private:
+		//the owner takes tiles from the front, thieves from the back
+		bool pop(Queue& queue, Tile& tile, bool back)
+		{
+			while (__sync_lock_test_and_set(&queue.lock, 1))
+				;
+			bool ret = queue.head < queue.tail;
+			if (ret)
+				tile = tiles[back ? --queue.tail : queue.head++];
+			__sync_lock_release(&queue.lock);
+			return ret;
+		}
+
+		//position of a tile along the chosen curve; neighbours on the
+		//Morton and Hilbert curves are neighbours on the image too
+		static GLuint key(GLuint x, GLuint y, GLuint columns, GLuint lines, Order order)
+		{
+			GLuint ret = 0;
+			if (order == rows)
+				ret = y * columns + x;
+			else if (order == morton)
+				for (GLuint b = 0; b < 16; b++)
+					ret |= ((x >> b) & 1) << (2*b) | ((y >> b) & 1) << (2*b + 1);
+			else {
+				GLuint n = 1;
+				while (n < columns || n < lines)
+					n *= 2;
+				for (GLuint s = n / 2; s > 0; s /= 2) {
+					GLuint rx = (x & s) > 0, ry = (y & s) > 0;
+					ret += s * s * ((3 * rx) ^ ry);
+					if (ry == 0) {
+						if (rx == 1) {
+							x = n - 1 - x;
+							y = n - 1 - y;
+						}
+						std::swap(x, y);
+					}
+				}
+			}
+			return ret;
+		}
+	};
+
+	//the picture as one 64 byte aligned block of float RGB pixels, row by
+	//row, plus the RGB8 plane pack() fills for display and output. Both are
+	//only reallocated when a resize outgrows them.
+	struct Framebuffer
+	{
+		GLint width, height;
+
+		Framebuffer():width(0),height(0),colors(0),bytes(0),capacity(0),byteCapacity(0) { }
+		~Framebuffer() { free(colors); free(bytes); }
+
+		void resize(GLint w, GLint h)
+		{
+			width = w;
+			height = h;
+			size_t size = (size_t)w * h;
+			if (size > capacity) {
+				colors = (GLfloat*)allocate(colors, 3 * size * sizeof(GLfloat));
+				capacity = size;
+			}
+		}
+
+		Color operator()(GLint x, GLint y) const
+		{
+			GLfloat const* p = colors + 3 * ((size_t)y * width + x);
+			return Color(p[0], p[1], p[2]);
+		}
+
+		void set(GLint x, GLint y, Color const& c)
+		{
+			GLfloat* p = colors + 3 * ((size_t)y * width + x);
+			p[0] = c.red;
+			p[1] = c.green;
+			p[2] = c.blue;
+		}
+
+		//quantizes every pixel into the RGB8 plane, allocating it the first time
+		GLubyte const* pack()
+		{
+			size_t size = 3 * (size_t)width * height;
+			if (size > byteCapacity) {
+				bytes = (GLubyte*)allocate(bytes, size);
+				byteCapacity = size;
+			}
+			for (size_t i = 0; i < size; i++)
+				bytes[i] = quantize(colors[i]);
+			return bytes;
+		}
+
+		//the plane as of the last pack()
+		GLubyte const* packed() const { return bytes; }
+
+		private:
+			GLfloat* colors;
+			GLubyte* bytes;
+			size_t capacity, byteCapacity;
+
+			static void* allocate(void* old, size_t size)
+			{
+				void* ret = 0;
+				free(old);
+				if (posix_memalign(&ret, 64, size))
+					abort();
+				return ret;
+			}
+
+			Framebuffer(Framebuffer const&);
+			Framebuffer& operator=(Framebuffer const&);
+	};
+
+	//the queues of a wavefront render (see renderWavefront). Rays wait on
+	//the stack to be intersected; every hit worth shading becomes a node,
+	//whose reflection and interreflection rays go back on the stack and
+	//whose light samples wait in shadows to be occluded. A node is resolved
+	//into its parent, or its pixel, once the last of its rays is done, and
+	//its slot goes on free for the next one.
+	struct Wavefront
+	{
+		struct Entry
+		{
+			Ray ray;
+			Intersection hit;
+			//the node that shot the ray, or -1 for a primary one
+			GLint parent;
+			//the pixel of a primary ray, 0 for a reflection and 1 + the
+			//object for an interreflection
+			GLuint slot;
+			//what the color found is scaled by before it is added there
+			Scalar weight;
+			//seeds the light samples of the node it makes
+			unsigned long long key;
+			//the node made, or -1, where its rays and shadows go, and how
+			//many light samples it takes
+			GLint node;
+			GLuint children, shadows, samples;
+		};
+
+		struct Node
+		{
+			Intersection hit;
+			GLint parent;
+			GLuint slot;
+			Scalar weight;
+			//ambient, lights and reflection so far
+			Color color;
+			//rays shot that are not done yet
+			GLuint pending;
+		};
+
+		struct Shadow
+		{
+			Point origin;
+			//what the light adds to the node if nothing is in the way
+			Color light;
+			GLuint node;
+			bool lit;
+		};
+
+		std::vector<Entry> stack, rays;
+		std::vector<Node> nodes;
+		std::vector<GLuint> free;
+		//one interreflection sum per object for each node
+		std::vector<Color> sums;
+		std::vector<Shadow> shadows;
+	};
+
+	template<GLuint antialias, GLuint depthRays, GLuint shadows, GLuint interreflections>
+	struct RayData
+	{
+		Scalar compensation;
+		Scalar shadows_compensation;
+		Scalar interreflections_compensation;
+
+		GLdouble modelview[16], projection[16];
+		GLdouble unprojection[16]; //inverse of projection * modelview
+		Point corner, stepX, stepY; //the near plane, see refreshCamera
+		GLint viewport[4];
+
+		//pixel (i, j) of the picture, whose RGB8 plane is bottom row first,
+		//ready for glDrawPixels
+		Framebuffer buffer;
+
+		Camera camera;
+
+		bool changed;
+
+		//primary rays traced together: 1 traces them one by one, 4, 8 and 16
+		//trace 2x2, 4x2 and 4x4 pixel blocks as packets
+		GLuint packet;
+
+		//one entry per thread, only counted when built with RAYTRACE_STATS
+		std::vector<Statistics> statistics;
+
+		//seconds the last frame spent tracing and drawing
+		GLdouble traceTime, displayTime;
+
+		//tile side in pixels, the order tiles are handed out in, and the
+		//scheduler doing it, which keeps what each thread did last frame
+		GLint tile;
+		Scheduler::Order order;
+		Scheduler scheduler;
+
+		//area light samples are drawn from one generator per thread,
+		//reseeded from this, the pixel and the sample before each sample
+		GLuint seed;
+		std::vector<Random> generators;
+
+		#ifdef RAYTRACE_CACHE
+		//shaded hits, kept from frame to frame
+		RayCache cache;
+		#endif
+
+		//progressive renders trace one sample per pixel per frame, adding it
+		//to the sums in accumulated, until samples passes are done; moving
+		//the camera or resizing starts over. They go through all nine
+		//antialias offsets whatever antialias is, so by default they stop
+		//once every offset met every lens and light sample. Each pass shows
+		//the mean so far: once every offset met every lens sample, that is
+		//the frame a fixed render draws at antialias 9.
+		bool progressive;
+		GLuint samples;
+		GLuint passes;
+		std::vector<Color> accumulated;
+
+		//adaptive renders take the center sample of every pixel first, and
+		//the other antialias samples only where a pixel differs from a
+		//neighbour (see edge). refined counts those pixels.
+		bool adaptive;
+		Scalar threshold;
+		std::vector<Intersection> hits;
+		GLuint refined;
+
+		//interreflections take I samples from at most this many of the
+		//objects a hit can see, picked by solid angle (see Interreflections)
+		GLuint sources;
+
+		//wavefront renders trace the frame stage by stage, wave rays of
+		//any kind in each batch, instead of pixel by pixel. Progressive and
+		//adaptive renders keep going through the tiles.
+		bool wavefront;
+		GLuint wave;
+		Wavefront queues;
+
+		//antialias samples the last frame took per pixel, on average
+		GLdouble samplesPerPixel;
+
+		RayData()
+		: compensation(1/((GLdouble)(antialias * depthRays))),
+		  shadows_compensation(1/((GLdouble)shadows)),
+		  interreflections_compensation(1/((GLdouble)interreflections)),
+		  camera(Camera(origin,origin,origin,0,0,0,0)),changed(false),packet(1),
+		  statistics(threads()),traceTime(0),displayTime(0),tile(16),order(Scheduler::rows),
+		  seed(0),generators(threads()),progressive(false),samples(9 * depthRays * shadows),passes(0),
+		  adaptive(false),threshold(0.05),refined(0),sources(8),wavefront(false),wave(1 << 12),samplesPerPixel(0)
+		{
+			viewport[0] = viewport[1] = viewport[2] = viewport[3] = 0;
+		}
+		RayData(Camera c)
+		: compensation(1/((GLdouble)(antialias * depthRays))),
+		  shadows_compensation(1/((GLdouble)shadows)),
+		  interreflections_compensation(1/((GLdouble)interreflections)),
+		  camera(c),changed(true),packet(1),statistics(threads()),
+		  traceTime(0),displayTime(0),tile(16),order(Scheduler::rows),
+		  seed(0),generators(threads()),progressive(false),samples(9 * depthRays * shadows),passes(0),
+		  adaptive(false),threshold(0.05),refined(0),sources(8),wavefront(false),wave(1 << 12),samplesPerPixel(0)
+		{
+			init();
+		}
+
+		void refreshCamera()
+		{
+			changed = true;
+			passes = 0;
+			lookAt(modelview, camera.lookFrom, camera.lookAt, camera.up);
+			perspective(projection, camera.fovY, (GLdouble) viewport[2]/viewport[3], camera.near, camera.far);
+
+			GLdouble m[16];
+			multiply(m, projection, modelview);
+			invert(unprojection, m);
+
+			//the near plane as a corner and a step per pixel, so a primary
+			//ray's end point costs two multiply-adds instead of an unProject
+			Point forward = (camera.lookAt - camera.lookFrom).unitary();
+			Point side = (forward % camera.up).unitary();
+			Point up = side % forward;
+			Scalar height = camera.near * tan(camera.fovY / 2 * M_PI / 180);
+			Scalar width = height * viewport[2] / viewport[3];
+
+			stepX = (2 * width / viewport[2]) * side;
+			stepY = (2 * height / viewport[3]) * up;
+			corner = camera.lookFrom + camera.near * forward - width * side - height * up
+				   - viewport[0] * stepX - viewport[1] * stepY;
+		}
+
+		void changeCamera(Camera& c)
+		{
+			camera = c;
+			refreshCamera();
+		}
+
+		//window coordinates back to world space, like gluUnProject
+		Point unProject(GLdouble x, GLdouble y, GLdouble z) const
+		{
+			GLdouble in[4] = { 2 * (x - viewport[0]) / viewport[2] - 1,
+							   2 * (y - viewport[1]) / viewport[3] - 1,
+							   2 * z - 1, 1 };
+			GLdouble out[4];
+			for (GLuint i = 0; i < 4; i++)
+				out[i] = unprojection[i]*in[0] + unprojection[4+i]*in[1] +
+						 unprojection[8+i]*in[2] + unprojection[12+i]*in[3];
+			return Point(out[0]/out[3], out[1]/out[3], out[2]/out[3]);
+		}
+
+		//window coordinates to the near plane, unProject(x, y, 0) within rounding
+		Point pixel(Scalar x, Scalar y) const
+		{
+			return corner + x * stepX + y * stepY;
+		}
+
+		//the depthRays lens rays of antialias sample k of pixel (i, j). Out
+		//of line so that every render path shoots the same bits: inlined,
+		//-Ofast fuses the arithmetic differently at each call site, and a
+		//ray grazing a shadow edge lands on either side of it.
+		__attribute__((noinline))
+		void primaries(GLint i, GLint j, GLuint k, Ray* rays) const
+		{
+			Point depth[depthRays];
+			Point end = pixel(i+Sampling::circle_x[k],viewport[3]-j-1+Sampling::circle_y[k]);
+			intersectionPoints(depth,depthRays,camera.lookFrom,end,camera.lensHeight);
+			for (GLuint r = 0; r < depthRays; r++)
+				rays[r] = Line(depth[r],end).toRay(camera.far);
+		}
+
+		void init()
+		{
+			#ifndef RAYTRACE_HEADLESS
+			glGetIntegerv (GL_VIEWPORT, viewport);
+			#endif
+			refreshCamera();
+			buffer.resize(viewport[2], viewport[3]);
+			accumulated.resize(viewport[2] * viewport[3]);
+			hits.resize(viewport[2] * viewport[3]);
+			scheduler.plan(viewport[2], viewport[3], tile, order);
+		}
+
+		void pack() { buffer.pack(); }
+
+		void refresh() { init(); }
+
+		//sets the image size directly, for renders without a window
+		void resize(GLint width, GLint height)
+		{
+			viewport[0] = viewport[1] = 0;
+			viewport[2] = width;
+			viewport[3] = height;
+			init();
+		}
+
+		#ifdef RAYTRACE_STATS
+		void count(unsigned long long Statistics::* rays, GLuint n = 1)
+		{ statistics[thread()].*rays += n; }
+		#else
+		void count(unsigned long long Statistics::*, GLuint = 1) { }
+		#endif
+
+		Statistics total() const
+		{
+			Statistics ret;
+			for (GLuint i = 0; i < statistics.size(); i++)
+				ret += statistics[i];
+			return ret;
+		}
+
+		void resetStatistics() { statistics.assign(threads(), Statistics()); }
+
+		Random& random() { return generators[thread()]; }
+
+		//whether the center sample of a pixel differs from one of its
+		//neighbours' in what it hit, the normal there or its color
+		bool edge(GLint i, GLint j) const
+		{
+			const GLint di[] = { -1, 1, 0, 0 }, dj[] = { 0, 0, -1, 1 };
+			Intersection const& a = hits[j * viewport[2] + i];
+			Color const& c = accumulated[j * viewport[2] + i];
+			for (GLuint n = 0; n < 4; n++) {
+				GLint x = i + di[n], y = j + dj[n];
+				if (x < 0 || y < 0 || x >= viewport[2] || y >= viewport[3])
+					continue;
+
+				Intersection const& b = hits[y * viewport[2] + x];
+				Color const& d = accumulated[y * viewport[2] + x];
+				if ((a.length > PRECISION) != (b.length > PRECISION))
+					return true;
+				if (a.length > PRECISION && (a.index != b.index || a.normal * b.normal < 0.95))
+					return true;
+				if (maximum(maximum(fabs(c.red - d.red), fabs(c.green - d.green)), fabs(c.blue - d.blue)) >
+					threshold * depthRays)
+					return true;
+			}
+			return false;
+		}
+	};
+
+
+	#ifndef RAYTRACE_HEADLESS
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	void render(RayData<AA,D,S,I>& data, World const& world)
+	{
+		GLdouble begin = now();
+		data.traceTime = 0;
+		if (data.changed) {
+			prerender(data,world);
+			data.pack();
+			data.traceTime = now() - begin;
+			begin = now();
+		}
+
+		//the whole frame in one upload, with the raster position at the
+		//bottom left corner of the glOrtho(0, w, 0, h) window
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		glClear (GL_COLOR_BUFFER_BIT);
+		glRasterPos2i(0, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glDrawPixels(data.viewport[2], data.viewport[3], GL_RGB, GL_UNSIGNED_BYTE, data.buffer.packed());
+		glFinish();
+		data.displayTime = now() - begin;
+	}
+	#endif
+
+	//the lens rays of antialias sample k of pixel (i, j), summed. hit is
+	//what the first of them hit.
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	Color sample(RayCache& cache, RayData<AA,D,S,I>& data, World const& world,
+				 GLint i, GLint j, GLuint k, Intersection& hit)
+	#else
+	Color sample(RayData<AA,D,S,I>& data, World const& world,
+				 GLint i, GLint j, GLuint k, Intersection& hit)
+	#endif
+	{
+		Color ret;
+		Ray rays[D];
+
+		data.primaries(i,j,k,rays);
+		for (GLuint r = 0; r < D; r++) {
+			Ray& ray = rays[r];
+			Intersection intersected = world.intersect(ray);
+			data.count(&Statistics::primary);
+			data.random().seed(data.seed, i, j, k*D + r);
+			if (r == 0)
+				hit = intersected;
+			if (intersected.length > PRECISION)
+				#ifdef RAYTRACE_CACHE
+				ret += propagateRay(cache,data,world,ray,intersected);
+				#else
+				ret += propagateRay(data,world,ray,intersected);
+				#endif
+		}
+		return ret;
+	}
+
+	//the samples of the pixels in a tile, one ray at a time
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	void renderTile(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#else
+	void renderTile(RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#endif
+	{
+		Color tmp;
+		Intersection hit;
+
+		for (GLint j = tile.y; j < tile.y + tile.height; j++)
+			for (GLint i = tile.x; i < tile.x + tile.width; i++) {
+				tmp = black;
+				for (GLuint k = 0; k < AA; k++) {
+					#ifdef RAYTRACE_CACHE
+					tmp += sample(cache,data,world,i,j,k,hit);
+					#else
+					tmp += sample(data,world,i,j,k,hit);
+					#endif
+				}
+				data.buffer.set(i, j, data.compensation * tmp);
+			}
+	}
+
+	//first pass of an adaptive render: the center sample of every pixel,
+	//kept with what it hit for the second pass to compare
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	void renderCenters(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#else
+	void renderCenters(RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#endif
+	{
+		for (GLint j = tile.y; j < tile.y + tile.height; j++)
+			for (GLint i = tile.x; i < tile.x + tile.width; i++) {
+				GLuint p = j * data.viewport[2] + i;
+				#ifdef RAYTRACE_CACHE
+				data.accumulated[p] = sample(cache,data,world,i,j,0,data.hits[p]);
+				#else
+				data.accumulated[p] = sample(data,world,i,j,0,data.hits[p]);
+				#endif
+			}
+	}
+
+	//second pass: pixels on an edge take the rest of the antialias samples,
+	//the others keep their center one
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	void renderEdges(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#else
+	void renderEdges(RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#endif
+	{
+		Intersection hit;
+		GLuint refined = 0;
+
+		for (GLint j = tile.y; j < tile.y + tile.height; j++)
+			for (GLint i = tile.x; i < tile.x + tile.width; i++) {
+				Color tmp = data.accumulated[j * data.viewport[2] + i];
+				GLuint n = 1;
+				if (AA > 1 && data.edge(i, j)) {
+					for (GLuint k = 1; k < AA; k++)
+						#ifdef RAYTRACE_CACHE
+						tmp += sample(cache,data,world,i,j,k,hit);
+						#else
+						tmp += sample(data,world,i,j,k,hit);
+						#endif
+					n = AA;
+					refined++;
+				}
+				data.buffer.set(i, j, (1.0 / (n * D)) * tmp);
+			}
+		__sync_fetch_and_add(&data.refined, refined);
+	}
+
+	//same samples as renderTile, but a block of pixels shoots each of them
+	//as one packet. Shading is still done ray by ray, in the same order.
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	void renderPackets(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#else
+	void renderPackets(RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#endif
+	{
+		const GLint width = data.packet >= 8 ? 4 : 2;
+		const GLint height = data.packet >= 16 ? 4 : 2;
+
+		for (GLint j = tile.y; j < tile.y + tile.height; j += height)
+			for (GLint i = tile.x; i < tile.x + tile.width; i += width) {
+				Packet packet;
+				Ray rays[Packet::SIZE][D];
+				Color tmp[Packet::SIZE];
+				GLint x[Packet::SIZE], y[Packet::SIZE];
+				GLuint pixels = 0;
+
+				for (GLint b = 0; b < height && j + b < tile.y + tile.height; b++)
+					for (GLint a = 0; a < width && i + a < tile.x + tile.width; a++) {
+						x[pixels] = i + a;
+						y[pixels++] = j + b;
+					}
+
+				for (GLuint k = 0; k < AA; k++) {
+					for (GLuint p = 0; p < pixels; p++)
+						data.primaries(x[p],y[p],k,rays[p]);
+					for (GLuint r = 0; r < D; r++) {
+						packet.clear();
+						for (GLuint p = 0; p < pixels; p++)
+							packet.add(rays[p][r]);
+						world.intersect(packet);
+						data.count(&Statistics::primary, pixels);
+
+						for (GLuint p = 0; p < pixels; p++) {
+							data.random().seed(data.seed, x[p], y[p], k*D + r);
+							if (packet.hits[p].length > PRECISION)
+								#ifdef RAYTRACE_CACHE
+								tmp[p] += propagateRay(cache,data,world,packet.rays[p],packet.hits[p]);
+								#else
+								tmp[p] += propagateRay(data,world,packet.rays[p],packet.hits[p]);
+								#endif
+						}
+					}
+				}
+
+				for (GLuint p = 0; p < pixels; p++)
+					data.buffer.set(x[p], y[p], data.compensation * tmp[p]);
+			}
+	}
+
+	//one more sample for every pixel of a tile, added to the ones earlier
+	//passes took since the camera last changed. Passes walk through the
+	//antialias offsets, then the lens samples, and each one draws new light
+	//samples.
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	#ifdef RAYTRACE_CACHE
+	void renderPass(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#else
+	void renderPass(RayData<AA,D,S,I>& data, World const& world, Tile const& tile)
+	#endif
+	{
+		const GLuint k = data.passes % 9;
+		const GLuint r = data.passes / 9 % D;
+		const Scalar weight = 1.0 / (data.passes + 1);
+
+		Point end;
+		Point depth[D];
+		Ray ray;
+		Intersection intersected;
+
+		//each pixel of a row is a step right of the last
+		for (GLint j = tile.y; j < tile.y + tile.height; j++) {
+			end = data.pixel(tile.x-1+Sampling::circle_x[k],data.viewport[3]-j-1+Sampling::circle_y[k]);
+			for (GLint i = tile.x; i < tile.x + tile.width; i++) {
+				end += data.stepX;
+				intersectionPoints(depth,D,data.camera.lookFrom,end,
+								   data.camera.lensHeight);
+
+				ray = Line(depth[r],end).toRay(data.camera.far);
+				intersected = world.intersect(ray);
+				data.count(&Statistics::primary);
+				data.random().seed(data.seed, i, j, data.passes);
+
+				Color& sum = data.accumulated[j * data.viewport[2] + i];
+				if (data.passes == 0)
+					sum = black;
+				if (intersected.length > PRECISION)
+					#ifdef RAYTRACE_CACHE
+					sum += propagateRay(cache,data,world,ray,intersected);
+					#else
+					sum += propagateRay(data,world,ray,intersected);
+					#endif
+				data.buffer.set(i, j, weight * sum);
+			}
+		}
+	}
+
+	//the same objects for a node when its rays are counted and when they are shot
+	inline void pick(Interreflections& sources, unsigned long long key)
+	{
+		if (sources.sampled()) {
+			Random random(~key);
+			sources.start(random.rand());
+		}
+	}
+
+	//shades the hit of an entry into its node, the way propagateRay would
+	//up to the recursion: ambient, the reflection and interreflection rays
+	//pushed on the stack, and the light samples, each with what it adds if
+	//it turns out unoccluded
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	void shade(RayData<AA,D,S,I>& data, World const& world, Wavefront::Entry const& entry)
+	{
+		Wavefront& q = data.queues;
+		Wavefront::Node& node = q.nodes[entry.node];
+		Intersection const& result = entry.hit;
+		Ray ray = entry.ray;
+		Material material = world.materials[world.objects[result.index]->material];
+
+		node.hit = result;
+		node.parent = entry.parent;
+		node.slot = entry.slot;
+		node.weight = entry.weight;
+		node.color = material.color * world.ambientIntensity * material.ambient;
+
+		Wavefront::Entry* child = &q.stack[entry.children];
+		Wavefront::Entry base;
+		base.parent = entry.node;
+		base.weight = 1;
+
+		if (material.reflection > 0) {
+			Point origin = ray.origin.unitary();
+			base.ray = Line(result.where,
+							result.where + ray.strength *
+							((2*(result.normal*origin))*result.normal - origin)).toRay(ray.strength);
+			base.slot = 0;
+			base.key = mix(entry.key) ^ 1;
+			*child++ = base;
+			node.color *= 1 - material.reflection;
+		}
+
+		if (I > 0) {
+			Point points[I > 0 ? I : 1];
+			Color* sums = &q.sums[entry.node * world.objects.size()];
+			for (GLuint i = 0; i < world.objects.size(); i++)
+				sums[i] = black;
+
+			Interreflections sources(world, result, data.sources);
+			pick(sources, entry.key);
+			GLuint i;
+			Scalar weight;
+			while (sources.next(i, weight)) {
+				intersectionPoints(points, I, world.objects[i]->position,
+								   result.where, world.objects[i]->scale);
+				for (GLuint j = 0; j < I; j++) {
+					base.ray = Line(result.where,points[j]).toRay(ray.strength);
+					base.slot = 1 + i;
+					base.weight = weight;
+					base.key = mix(entry.key) ^ (2 + i * I + j);
+					*child++ = base;
+				}
+			}
+		}
+
+		Point points[S];
+		Random& random = data.random();
+		random.seed(entry.key);
+		Wavefront::Shadow* shadow = &q.shadows[entry.shadows];
+		GLuint const* first, * last;
+		world.grid.find(result.where, first, last);
+		for (; first != last; first++) {
+			GLuint i = *first;
+			Light const& l = world.lights[i];
+			if (!world.grid.reaches(l, i, result.where))
+				continue;
+			intersectionPoints(points, S, l.position, result.where, l.radius, &random);
+			for (GLuint k = 0; k < S; k++, shadow++) {
+				shadow->node = entry.node;
+				shadow->origin = points[k];
+				shadow->lit = false;
+
+				Point light = points[k] - result.where;
+				Scalar length = light.length();
+				light /= length;
+
+				Scalar NL = result.normal * light;
+				if (length >= world.grid.cutoffs[i] || NL <= 0)
+					continue;
+				shadow->lit = true;
+
+				Scalar iLight = l.intensity / (length * length);
+				Point reflectedLight = (2*NL)*result.normal - light;
+				Scalar phi = (reflectedLight * ray.origin) /
+							 (reflectedLight.length() * ray.origin.length());
+				Scalar str = 0, str2 = 0;
+				if (phi > 0)
+					str2 = pow(phi, material.shinny) * iLight;
+				if (material.reflection < 1 && NL * iLight > 0)
+					str = NL * iLight;
+
+				str *= data.shadows_compensation;
+				str2 *= data.shadows_compensation;
+				shadow->light = ((str * (1 - material.reflection)) * material.diffuse * l.color) *
+								material.color + (str2 * l.color * material.specular);
+			}
+		}
+	}
+
+	//a node whose rays are all done: its interreflections scale it like
+	//propagateRay's do, and it is added into its parent, which may then be
+	//done too, or into its pixel
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	void resolve(RayData<AA,D,S,I>& data, World const& world, GLuint m)
+	{
+		Wavefront& q = data.queues;
+		const GLuint objects = world.objects.size();
+		for (;;) {
+			Wavefront::Node const& node = q.nodes[m];
+			Color color = node.color;
+			if (I > 0) {
+				Material const& material = world.materials[world.objects[node.hit.index]->material];
+				for (GLuint i = 0; i < objects; i++)
+					if (i != node.hit.index)
+						color += material.diffuse *
+								 (color * (data.interreflections_compensation * q.sums[m * objects + i]));
+			}
+			color *= (data.camera.far - node.hit.length)/data.camera.far;
+			q.free.push_back(m);
+
+			if (node.parent < 0) {
+				data.accumulated[node.slot] += node.weight * color;
+				return;
+			}
+			Wavefront::Node& parent = q.nodes[node.parent];
+			if (node.slot == 0)
+				parent.color += node.weight * color;
+			else
+				q.sums[node.parent * objects + node.slot - 1] += node.weight * color;
+			if (--parent.pending > 0)
+				return;
+			m = node.parent;
+		}
+	}
+
+	//the frame as batches of up to wave rays, each going through the
+	//stages below as one parallel loop: generate primary rays when the
+	//stack runs low, intersect the newest rays on it, shade the hits worth
+	//it into nodes, occlude their light samples and accumulate the lit
+	//ones. Finished nodes are weighted back into their pixel (see resolve).
+	//Taking the newest rays first keeps the stack and the nodes alive to
+	//about wave per bounce however much a pixel branches. The same samples
+	//as renderTile, without the cache.
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	void renderWavefront(RayData<AA,D,S,I>& data, World const& world)
+	{
+		Wavefront& q = data.queues;
+		const GLint width = data.viewport[2], height = data.viewport[3];
+		const GLuint objects = world.objects.size();
+		const GLuint samples = AA * D;
+		const GLuint total = width * height * samples;
+		const GLuint wave = std::max(data.wave, 1U);
+		const Scalar far = data.camera.far;
+
+		data.accumulated.assign(width * height, black);
+		q.stack.clear();
+		q.nodes.clear();
+		q.free.clear();
+
+		for (GLuint first = 0; first < total || !q.stack.empty(); ) {
+			//generate
+			if (q.stack.size() < wave && first < total) {
+				const GLuint n = std::min(wave - (GLuint)q.stack.size(), total - first);
+				const GLuint top = q.stack.size();
+				q.stack.resize(top + n);
+				#ifndef RAYTRACE_NONPARALLEL
+				#pragma omp parallel for schedule(static)
+				#endif
+				for (GLint e = 0; e < (GLint)n; e++) {
+					GLuint s = first + e;
+					GLuint p = s / samples, k = s / D % AA, r = s % D;
+					GLint i = p % width, j = p / width;
+
+					Ray rays[D];
+					data.primaries(i,j,k,rays);
+
+					Wavefront::Entry& entry = q.stack[top + e];
+					entry.ray = rays[r];
+					entry.parent = -1;
+					entry.slot = p;
+					entry.weight = data.compensation;
+					entry.key = mix(mix(mix(data.seed) ^ (GLuint)i) ^ (GLuint)j) ^ (k*D + r);
+					data.count(&Statistics::primary);
+				}
+				first += n;
+			}
+
+			const GLuint n = std::min(wave, (GLuint)q.stack.size());
+			q.rays.assign(q.stack.end() - n, q.stack.end());
+			q.stack.resize(q.stack.size() - n);
+
+			//intersect, and see which hits make a node and how many rays it shoots
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp parallel for schedule(dynamic, 64)
+			#endif
+			for (GLint e = 0; e < (GLint)n; e++) {
+				Wavefront::Entry& entry = q.rays[e];
+				Intersection const& hit = entry.hit = world.intersect(entry.ray);
+				bool make;
+				if (entry.parent < 0)
+					make = hit.length > PRECISION;
+				else {
+					data.count(&Statistics::secondary);
+					Wavefront::Node const& parent = q.nodes[entry.parent];
+					Material const& material = world.materials[world.objects[parent.hit.index]->material];
+					entry.ray.strength -= hit.length;
+					if (entry.slot == 0) {
+						entry.ray.strength *= material.reflection;
+						entry.weight = material.reflection;
+						make = entry.ray.strength/far > 0.01 && hit.length > 0 &&
+							   hit.where != parent.hit.where;
+					} else {
+						entry.ray.strength *= maximum(maximum(material.diffuse.blue,material.diffuse.red),
+													  material.diffuse.green);
+						entry.weight *= parent.hit.normal * (hit.where - parent.hit.where).unitary();
+						make = entry.ray.strength/far > 0.01 && entry.weight > 0;
+					}
+				}
+
+				entry.node = make ? 0 : -1;
+				if (!make)
+					continue;
+				entry.children = world.materials[world.objects[hit.index]->material].reflection > 0;
+				entry.samples = 0;
+				GLuint const* first, * last;
+				for (world.grid.find(hit.where, first, last); first != last; first++)
+					if (world.grid.reaches(world.lights[*first], *first, hit.where))
+						entry.samples += S;
+				if (I > 0) {
+					Interreflections sources(world, hit, data.sources);
+					pick(sources, entry.key);
+					GLuint i;
+					Scalar weight;
+					while (sources.next(i, weight))
+						entry.children += I;
+				}
+			}
+
+			//where the nodes and everything they shoot go
+			GLuint children = q.stack.size(), shadows = 0;
+			for (GLuint e = 0; e < n; e++) {
+				Wavefront::Entry& entry = q.rays[e];
+				if (entry.node < 0) {
+					if (entry.parent >= 0 && --q.nodes[entry.parent].pending == 0)
+						resolve(data, world, entry.parent);
+					continue;
+				}
+
+				if (q.free.empty()) {
+					q.free.push_back(q.nodes.size());
+					q.nodes.resize(q.nodes.size() + 1);
+					if (I > 0)
+						q.sums.resize(q.nodes.size() * objects);
+				}
+				entry.node = q.free.back();
+				q.free.pop_back();
+
+				GLuint rays = entry.children;
+				q.nodes[entry.node].pending = rays;
+				entry.children = children;
+				entry.shadows = shadows;
+				children += rays;
+				shadows += entry.samples;
+			}
+			q.stack.resize(children);
+			q.shadows.resize(shadows);
+
+			//shade
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp parallel for schedule(dynamic, 64)
+			#endif
+			for (GLint e = 0; e < (GLint)n; e++)
+				if (q.rays[e].node >= 0)
+					shade(data, world, q.rays[e]);
+
+			//occlude
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp parallel for schedule(dynamic, 64)
+			#endif
+			for (GLint s = 0; s < (GLint)shadows; s++) {
+				Wavefront::Shadow& shadow = q.shadows[s];
+				if (!shadow.lit)
+					continue;
+				data.count(&Statistics::shadow);
+				Intersection const& hit = q.nodes[shadow.node].hit;
+				shadow.lit = !world.occluded(shadow.origin, hit.where, hit.index);
+			}
+
+			//accumulate, each node's light samples being in a row
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp parallel for schedule(dynamic, 64)
+			#endif
+			for (GLint e = 0; e < (GLint)n; e++) {
+				Wavefront::Entry const& entry = q.rays[e];
+				if (entry.node < 0)
+					continue;
+				Color& color = q.nodes[entry.node].color;
+				for (GLuint s = entry.shadows; s < entry.shadows + entry.samples; s++)
+					if (q.shadows[s].lit)
+						color += q.shadows[s].light;
+			}
+
+			//nodes that shot nothing are done already
+			for (GLuint e = 0; e < n; e++)
+				if (q.rays[e].node >= 0 && q.nodes[q.rays[e].node].pending == 0)
+					resolve(data, world, q.rays[e].node);
+		}
+
+		for (GLint j = 0; j < height; j++)
+			for (GLint i = 0; i < width; i++)
+				data.buffer.set(i, j, data.accumulated[j * width + i]);
+	}
+
+	//the threads pull tiles from the scheduler until none is left, timing
+	//how long each one works and how long it then waits for the others
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
+	void prerender(RayData<AA,D,S,I>& data, World const& world)
+	{
+		#ifdef RAYTRACE_CACHE
+		RayCache& cache = data.cache;
+		#endif
+
+		world.refresh();
+
+		//the stages of a wavefront render share out their own work, so the
+		//frame is timed as a whole
+		if (data.wavefront && !data.progressive && !data.adaptive) {
+			GLdouble begin = now();
+			renderWavefront(data, world);
+			data.scheduler.queues.assign(1, Scheduler::Queue());
+			data.scheduler.queues[0].busy = now() - begin;
+			data.changed = false;
+			data.samplesPerPixel = AA;
+			return;
+		}
+
+		#ifndef RAYTRACE_NONPARALLEL
+		#pragma omp parallel
+		#endif
+		{
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp single
+			#endif
+			{
+				data.scheduler.start(data.viewport[2], data.viewport[3], data.tile, data.order, team());
+				data.refined = 0;
+			}
+
+			Scheduler::Queue& queue = data.scheduler.queues[thread()];
+			GLdouble start = now();
+			Tile tile;
+			const GLuint phases = data.adaptive && !data.progressive ? 2 : 1;
+			for (GLuint phase = 0; phase < phases; phase++) {
+				//the edges need every center, so all tiles are dealt again
+				//once the first pass is over
+				if (phase > 0) {
+					#ifndef RAYTRACE_NONPARALLEL
+					#pragma omp barrier
+					#pragma omp single
+					#endif
+					data.scheduler.deal(team());
+				}
+
+				while (data.scheduler.next(thread(), tile)) {
+					GLdouble begin = now();
+					#ifdef RAYTRACE_CACHE
+					if (data.progressive)
+						renderPass(cache,data,world,tile);
+					else if (data.adaptive)
+						phase == 0 ? renderCenters(cache,data,world,tile) : renderEdges(cache,data,world,tile);
+					else if (data.packet > 1)
+						renderPackets(cache,data,world,tile);
+					else
+						renderTile(cache,data,world,tile);
+					#else
+					if (data.progressive)
+						renderPass(data,world,tile);
+					else if (data.adaptive)
+						phase == 0 ? renderCenters(data,world,tile) : renderEdges(data,world,tile);
+					else if (data.packet > 1)
+						renderPackets(data,world,tile);
+					else
+						renderTile(data,world,tile);
+					#endif
+					queue.busy += now() - begin;
+				}
+			}
+
+			#ifndef RAYTRACE_NONPARALLEL
+			#pragma omp barrier
+			#endif
+			queue.idle = now() - start - queue.busy;
+		}
+
+		//a progressive render stays changed until its last pass
+		if (data.progressive) {
+			data.changed = ++data.passes < data.samples;
+			data.samplesPerPixel = data.passes;
+		} else {
+			data.changed = false;
+			data.samplesPerPixel = data.adaptive ?
+				1 + data.refined * (AA - 1.0) / (data.viewport[2] * data.viewport[3]) : AA;
+		}
+	}
+
+	template<GLuint AA, GLuint D, GLuint S, GLuint I>
 	#ifdef RAYTRACE_CACHE
 	Color propagateRay(RayCache& cache, RayData<AA,D,S,I>& data, World const& world, Ray ray, Intersection result)
 	#else
@@ -655,20 +3634,14 @@ namespace RayTrace {
 	{
 		Color ret;
 		#ifdef RAYTRACE_CACHE
-		bool found = false;
-		for (GLuint i = 0; i < cache.intersections.size() && !found; i++)
-			if (result.where == cache.intersections[i]) {
-				ret = cache.colors[i];
-				found = true;
-			}
-		if (found)
+		if (cache.find(result.where, result.index, ret))
 			return ret;
 		#endif
 
 		Material material = world.materials[world.objects[result.index]->material];
 		ret = material.color * world.ambientIntensity * material.ambient;
 		
-		GLdouble str,str2;
+		Scalar str,str2;
 
 		Color tmp;
 		Line tmpLine;
@@ -684,6 +3657,7 @@ namespace RayTrace {
 						  ((2*(result.normal*origin))*result.normal - origin)).toRay(ray.strength);
 
 			tmpIntsc = world.intersect(tmpRay);
+			data.count(&Statistics::secondary);
 
 			tmpRay.strength -= tmpIntsc.length;
 			tmpRay.strength *= material.reflection;
@@ -701,33 +3675,41 @@ namespace RayTrace {
 
 		}
 
-		for (GLuint i = 0; i < world.lights.size(); i++) {
+		GLuint const* first, * last;
+		world.grid.find(result.where, first, last);
+		for (; first != last; first++) {
+			GLuint i = *first;
+			if (!world.grid.reaches(world.lights[i], i, result.where))
+				continue;
 			str = str2 = 0;
 
 			intersectionPoints(points, S, world.lights[i].position,
-							   result.where, world.lights[i].radius);
+							   result.where, world.lights[i].radius, &data.random());
 			for (GLuint k = 0; k < S; k++) {
 				Point light = points[k] - result.where;
-				Ray shadow = Line(points[k],result.where).toRay(world.lights[i].intensity);
+				Scalar length = light.length();
+				light /= length;
 
-				Intersection isShadow = world.intersect(shadow);
-				
-				if (isShadow.where == result.where)
-				{
-					GLdouble iLight = world.lights[i].intensity / (light.length() * light.length());
+				//lights only reach as far as their intensity, and surfaces
+				//facing away from one are shadowed by their own object
+				Scalar NL = result.normal * light;
+				if (length >= world.grid.cutoffs[i] || NL <= 0)
+					continue;
 
-					light = light.unitary();
+				data.count(&Statistics::shadow);
+				if (!world.occluded(points[k], result.where, result.index))
+				{
+					Scalar iLight = world.lights[i].intensity / (length * length);
 
-					GLdouble NL = result.normal * light;
 					Point reflectedLight = (2*NL)*result.normal - light;
-					GLdouble phi = (reflectedLight * ray.origin) / 
+					Scalar phi = (reflectedLight * ray.origin) / 
 								   (reflectedLight.length() * ray.origin.length());
 
 					if (phi > 0)
 						str2 += pow(phi, material.shinny) * iLight;
 
 					if (material.reflection < 1) {
-						GLdouble tmpStr = NL * iLight;
+						Scalar tmpStr = NL * iLight;
 						if (tmpStr > 0)
 							str += tmpStr;
 					}
@@ -739,52 +3721,42 @@ namespace RayTrace {
 					material.color + (str2 * world.lights[i].color * material.specular);
 		}
 
-		for(GLuint i = 0; i < world.objects.size(); i++)
-			if (i != result.index) {
-				tmp = black;
-				intersectionPoints(points, I, world.objects[i]->position,
-								   result.where, world.objects[i]->scale,false);
-				for(GLuint j = 0; j < I; j++) {
-					tmpLine = Line(result.where,points[j]); 
-					tmpRay = tmpLine.toRay(ray.strength);
-					tmpIntsc = world.intersect(tmpRay);
-
-					tmpRay.strength -= tmpIntsc.length;
-					tmpRay.strength *= fmax(fmax(material.diffuse.blue,material.diffuse.red),
-											material.diffuse.green);
-					
-					if (tmpRay.strength/data.camera.far > 0.01) {
-						str = result.normal * (tmpIntsc.where - result.where).unitary();
-						if (str > 0) {
-							#ifdef RAYTRACE_CACHE
-							found = false;
-							for (GLuint k = 0; k < cache.intersections.size() && !found; k++)
-								if (fabs(result.where.x - cache.intersections[k].x) < 0.001 &&
-									fabs(result.where.y - cache.intersections[k].y) < 0.001 &&
-									fabs(result.where.z - cache.intersections[k].z) < 0.001) {
-									found = true;
-									tmp += str * cache.colors[k];
-								}
-							if (!found)
-								tmp += str * propagateRay(cache,data,world,tmpRay,tmpIntsc);
-							#else
-								tmp += str * propagateRay(data,world,tmpRay,tmpIntsc);
-							#endif
-						}
-					}
+		Interreflections sources(world, result, data.sources);
+		if (sources.sampled())
+			sources.start(data.random().rand());
+		GLuint i;
+		Scalar weight;
+		while (sources.next(i, weight)) {
+			tmp = black;
+			intersectionPoints(points, I, world.objects[i]->position,
+							   result.where, world.objects[i]->scale);
+			for(GLuint j = 0; j < I; j++) {
+				tmpLine = Line(result.where,points[j]); 
+				tmpRay = tmpLine.toRay(ray.strength);
+				tmpIntsc = world.intersect(tmpRay);
+				data.count(&Statistics::secondary);
+
+				tmpRay.strength -= tmpIntsc.length;
+				tmpRay.strength *= maximum(maximum(material.diffuse.blue,material.diffuse.red),
+										material.diffuse.green);
+				
+				if (tmpRay.strength/data.camera.far > 0.01) {
+					str = result.normal * (tmpIntsc.where - result.where).unitary();
+					//propagateRay looks the hit up in the cache itself
+					if (str > 0)
+						#ifdef RAYTRACE_CACHE
+						tmp += str * propagateRay(cache,data,world,tmpRay,tmpIntsc);
+						#else
+						tmp += str * propagateRay(data,world,tmpRay,tmpIntsc);
+						#endif
 				}
-				tmp *= data.interreflections_compensation;
-				ret += material.diffuse * (ret * tmp);
 			}
+			tmp *= data.interreflections_compensation * weight;
+			ret += material.diffuse * (ret * tmp);
+		}
 
 		#ifdef RAYTRACE_CACHE
-		#ifndef RAYTRACE_NONPARALLEL
-		#pragma omp critical
-		#endif
-		{
-			cache.intersections.push_back(result.where);
-			cache.colors.push_back(ret);
-		}
+		cache.insert(result.where, result.index, ret);
 		#endif
 
 		ret *= (data.camera.far-result.length)/data.camera.far;
@@ -801,20 +3773,14 @@ namespace RayTrace {
 	{
 		Color ret;
 		#ifdef RAYTRACE_CACHE
-		bool found = false;
-		for (GLuint i = 0; i < cache.intersections.size() && !found; i++)
-			if (result.where == cache.intersections[i]) {
-				ret = cache.colors[i];
-				found = true;
-			}
-		if (found)
+		if (cache.find(result.where, result.index, ret))
 			return ret;
 		#endif
 
 		Material material = world.materials[world.objects[result.index]->material];
 		ret = material.color * world.ambientIntensity * material.ambient;
 		
-		GLdouble str,str2;
+		Scalar str,str2;
 
 		Color tmp;
 		Line tmpLine;
@@ -830,6 +3796,7 @@ namespace RayTrace {
 						  ((2*(result.normal*origin))*result.normal - origin)).toRay(ray.strength);
 
 			tmpIntsc = world.intersect(tmpRay);
+			data.count(&Statistics::secondary);
 
 			tmpRay.strength -= tmpIntsc.length;
 			tmpRay.strength *= material.reflection;
@@ -846,33 +3813,41 @@ namespace RayTrace {
 						#endif
 		}
 
-		for (GLuint i = 0; i < world.lights.size(); i++) {
+		GLuint const* first, * last;
+		world.grid.find(result.where, first, last);
+		for (; first != last; first++) {
+			GLuint i = *first;
+			if (!world.grid.reaches(world.lights[i], i, result.where))
+				continue;
 			str = str2 = 0;
 
 			intersectionPoints(points, S, world.lights[i].position,
-							   result.where, world.lights[i].radius);
+							   result.where, world.lights[i].radius, &data.random());
 			for (GLuint k = 0; k < S; k++) {
 				Point light = points[k] - result.where;
-				Ray shadow = Line(points[k],result.where).toRay(world.lights[i].intensity);
+				Scalar length = light.length();
+				light /= length;
 
-				Intersection isShadow = world.intersect(shadow);
-				
-				if (isShadow.where == result.where)
-				{
-					GLdouble iLight = world.lights[i].intensity / (light.length() * light.length());
+				//lights only reach as far as their intensity, and surfaces
+				//facing away from one are shadowed by their own object
+				Scalar NL = result.normal * light;
+				if (length >= world.grid.cutoffs[i] || NL <= 0)
+					continue;
 
-					light = light.unitary();
+				data.count(&Statistics::shadow);
+				if (!world.occluded(points[k], result.where, result.index))
+				{
+					Scalar iLight = world.lights[i].intensity / (length * length);
 
-					GLdouble NL = result.normal * light;
 					Point reflectedLight = (2*NL)*result.normal - light;
-					GLdouble phi = (reflectedLight * ray.origin) / 
+					Scalar phi = (reflectedLight * ray.origin) / 
 								   (reflectedLight.length() * ray.origin.length());
 
 					if (phi > 0)
 						str2 += pow(phi, material.shinny) * iLight;
 
 					if (material.reflection < 1) {
-						GLdouble tmpStr = NL * iLight;
+						Scalar tmpStr = NL * iLight;
 						if (tmpStr > 0)
 							str += tmpStr;
 					}
@@ -885,13 +3860,7 @@ namespace RayTrace {
 		}
 
 		#ifdef RAYTRACE_CACHE
-		#ifndef RAYTRACE_NONPARALLEL
-		#pragma omp critical
-		#endif
-		{
-			cache.intersections.push_back(result.where);
-			cache.colors.push_back(ret);
-		}
+		cache.insert(result.where, result.index, ret);
 		#endif
 
 		ret *= (data.camera.far-result.length)/data.camera.far;
@@ -900,22 +3869,22 @@ namespace RayTrace {
 	}
 }
 
-inline GLdouble				operator*(RayTrace::Point a, RayTrace::Point b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
-inline RayTrace::Point		operator*(GLdouble a, RayTrace::Point b)
+inline RayTrace::Scalar		operator*(RayTrace::Point a, RayTrace::Point b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline RayTrace::Point		operator*(RayTrace::Scalar a, RayTrace::Point b)
 {
 	b.x *= a;
 	b.y *= a;
 	b.z *= a;
 	return b;
 }
-inline RayTrace::Point		operator*(RayTrace::Point a, GLdouble b)
+inline RayTrace::Point		operator*(RayTrace::Point a, RayTrace::Scalar b)
 {
 	a.x *= b;
 	a.y *= b;
 	a.z *= b;
 	return a;
 }
-inline RayTrace::Point		operator/(RayTrace::Point a, GLdouble b)
+inline RayTrace::Point		operator/(RayTrace::Point a, RayTrace::Scalar b)
 {
 	a.x /= b;
 	a.y /= b;
@@ -960,14 +3929,14 @@ inline RayTrace::Point&	operator-=(RayTrace::Point& a, RayTrace::Point b)
 	a.z -= b.z;
 	return a;
 }
-inline RayTrace::Point&	operator*=(RayTrace::Point& a, GLdouble b)
+inline RayTrace::Point&	operator*=(RayTrace::Point& a, RayTrace::Scalar b)
 {
 	a.x *= b;
 	a.y *= b;
 	a.z *= b;
 	return a;
 }
-inline RayTrace::Point&	operator/=(RayTrace::Point& a, GLdouble b)
+inline RayTrace::Point&	operator/=(RayTrace::Point& a, RayTrace::Scalar b)
 {
 	a.x /= b;
 	a.y /= b;
@@ -1003,14 +3972,14 @@ inline RayTrace::Color		operator*(RayTrace::Color a, RayTrace::Color b)
 	a.blue *= b.blue;
 	return a;
 }
-inline RayTrace::Color		operator*(GLdouble a, RayTrace::Color b)
+inline RayTrace::Color		operator*(RayTrace::Scalar a, RayTrace::Color b)
 {
 	b.red *= a;
 	b.green *= a;
 	b.blue *= a;
 	return b;
 }
-inline RayTrace::Color		operator*(RayTrace::Color a, GLdouble b)
+inline RayTrace::Color		operator*(RayTrace::Color a, RayTrace::Scalar b)
 {
 	a.red *= b;
 	a.green *= b;
@@ -1032,7 +4001,7 @@ inline RayTrace::Color&	operator+=(RayTrace::Color& a, RayTrace::Color b)
 	a.blue += b.blue;
 	return a;
 }
-inline RayTrace::Color&	operator*=(RayTrace::Color& a, GLdouble b)
+inline RayTrace::Color&	operator*=(RayTrace::Color& a, RayTrace::Scalar b)
 {
 	a.red *= b;
 	a.green *= b;
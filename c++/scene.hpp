@@ -0,0 +1,400 @@
+#ifndef RAYTRACE_SCENE_H
+#define RAYTRACE_SCENE_H
+
+#include "raytrace.hpp"
+
+namespace RayTrace {
+	//the scene every front end starts with: a 3x3 grid of random cubes lit by two lights
+	Camera* demo(World& world, MTRand& random)
+	{
+		for (double i = -1; i < 2; i++)
+			for (double j = -1; j < 2; j++)
+				world.add(new Cube(Point(2*i,0,2*j),Point(0,1,0), random() * 2),Material(0.4,0.5,0,100,0.1,Color(random(),random(),random())));
+
+		world.add(Light(Point(5,-5,10),Color(1,1,1),400, 5));
+		world.add(Light(Point(-5,-5,-10),Color(1,1,1),250, 3));
+
+		return new Camera(Point(0,0,0),Point(10,-20,10),Point(0,1,0),30,3000,7,0.3);
+	}
+
+	//the eight reflective spheres rc renders, with its two lights
+	Camera* spheres(World& world)
+	{
+		for (GLuint i = 0; i < 8; i++) {
+			Point p(i & 4 ? -3 : 3, i & 2 ? -3 : 3, i & 1 ? -3 : 3);
+			Color c[] = { Color(1,0,0), Color(1,1,0), Color(1,0,1), Color(0,1,1),
+						  Color(0,1,0), Color(1,1,0), Color(1,0,1), Color(0,1,1) };
+			world.add(new Sphere(p,Point(0,1,0), 2),Material(0.5,0.5,i == 7 ? 0.9 : 0.7,50,0.1,c[i]));
+		}
+
+		world.add(Light(Point(0,-11,11),Color(1,1,1),250, 1));
+		world.add(Light(Point(-5,-5,-10),Color(1,1,1),150, 1));
+
+		return new Camera(Point(0,0,0),Point(-30,-20,32),Point(0,1,0),1,300,10,0.3);
+	}
+
+	//random cubes and spheres spread over a volume that grows with the object
+	//count, so the density (and the average ray length) stays the same
+	void populate(World& world, GLuint count, MTRand& random)
+	{
+		std::vector<Material> palette;
+		for (GLuint i = 0; i < 16; i++)
+			palette.push_back(Material(0.4,0.5,0,100,0.1,Color(random(),random(),random())));
+
+		GLdouble side = 4 * cbrt(count);
+		for (GLuint i = 0; i < count; i++) {
+			Point p(side * (random() - 0.5), side * (random() - 0.5), side * (random() - 0.5));
+			Material const& m = palette[i % palette.size()];
+			if (i % 2)
+				world.add(new Sphere(p,Point(0,1,0), 0.2 + random() * 0.8), m);
+			else
+				world.add(new Cube(p,Point(0,1,0), 0.4 + random() * 1.6), m);
+		}
+	}
+
+	//a populated volume seen from one corner, lit from two others
+	Camera* procedural(World& world, GLuint count, MTRand& random)
+	{
+		populate(world, count, random);
+
+		GLdouble side = 4 * cbrt(count);
+		world.add(Light(Point(side,-side,side),Color(1,1,1),16*side*side, 1));
+		world.add(Light(Point(-side,-side,-side),Color(1,1,1),8*side*side, 1));
+
+		return new Camera(Point(0,0,0),Point(-side,-side,side),Point(0,1,0),1,8*side,40,0.3);
+	}
+
+	//a populated volume lit by many small colored lights spread through it,
+	//each reaching about half its side
+	Camera* rig(World& world, GLuint count, GLuint lights, MTRand& random)
+	{
+		populate(world, count, random);
+
+		GLdouble side = 4 * cbrt(count);
+		for (GLuint i = 0; i < lights; i++) {
+			Point p(side * (random() - 0.5), side * (random() - 0.5), side * (random() - 0.5));
+			world.add(Light(p,Color(random(),random(),random()),side/2, 0.2));
+		}
+
+		return new Camera(Point(0,0,0),Point(-side,-side,side),Point(0,1,0),1,8*side,40,0.3);
+	}
+	//a bumpy unit sphere as 4*rings² triangles on a latitude/longitude grid,
+	//folded enough to shadow itself
+	void blob(std::vector<GLfloat>& vertices, std::vector<GLuint>& triangles, GLuint rings)
+	{
+		GLuint segments = 2*rings;
+		vertices.clear();
+		triangles.clear();
+		for (GLuint i = 0; i <= rings; i++)
+			for (GLuint j = 0; j < segments; j++) {
+				GLdouble theta = M_PI * i / rings, phi = 2 * M_PI * j / segments;
+				GLdouble r = 1 + 0.2 * sin(5*theta) * sin(7*phi);
+				vertices.push_back(r * sin(theta) * cos(phi));
+				vertices.push_back(r * cos(theta));
+				vertices.push_back(r * sin(theta) * sin(phi));
+			}
+		for (GLuint i = 0; i < rings; i++)
+			for (GLuint j = 0; j < segments; j++) {
+				GLuint a = i*segments + j, b = i*segments + (j + 1) % segments;
+				GLuint c = a + segments, d = b + segments;
+				triangles.push_back(a); triangles.push_back(c); triangles.push_back(b);
+				triangles.push_back(b); triangles.push_back(c); triangles.push_back(d);
+			}
+	}
+
+	//a blob of 4*rings² triangles scaled up among the cubes of the demo
+	Camera* sculpture(World& world, GLuint rings, MTRand& random)
+	{
+		Camera* ret = demo(world, random);
+
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> triangles;
+		blob(vertices, triangles, rings);
+		for (GLuint i = 0; i < vertices.size(); i++)
+			vertices[i] = vertices[i] * 1.5 + (i % 3 == 1 ? -2.5 : 0);
+		world.add(new TriangleMesh(vertices, triangles), Material(0.4,0.5,0.3,100,0.1,Color(0.8,0.8,0.8)));
+
+		return ret;
+	}
+	//the demo's 3x3 grid of cubes tiled side/3 times along x and z, a
+	//color per row of tiles. Either side² cubes or, instanced, one group of
+	//nine cubes placed along a row, which is a group placed side/3 times.
+	Camera* field(World& world, GLuint side, bool instanced, MTRand& random)
+	{
+		std::vector<Material> palette;
+		for (GLuint i = 0; i < 16; i++)
+			palette.push_back(Material(0.4,0.5,0,100,0.1,Color(random(),random(),random())));
+		Scalar sizes[9];
+		for (GLuint i = 0; i < 9; i++)
+			sizes[i] = random() * 2;
+
+		GLuint tiles = side/3;
+		Group* row = 0;
+		if (instanced) {
+			Group* tile = new Group();
+			row = new Group();
+			for (GLuint i = 0; i < 9; i++)
+				tile->add(new Cube(Point(2.0*(i/3) - 2,0,2.0*(i%3) - 2),Point(0,1,0), sizes[i]));
+			for (GLuint b = 0; b < tiles; b++)
+				row->add(new Instance(tile,Point(0,0,6*(b - (tiles - 1)/2.0)),Point(0,1,0),1));
+		}
+
+		for (GLuint a = 0; a < tiles; a++) {
+			Scalar x = 6*(a - (tiles - 1)/2.0);
+			Material const& m = palette[a % palette.size()];
+			if (instanced)
+				world.add(new Instance(row,Point(x,0,0),Point(0,1,0),1), m);
+			else
+				for (GLuint b = 0; b < tiles; b++)
+					for (GLuint i = 0; i < 9; i++)
+						world.add(new Cube(Point(x + 2.0*(i/3) - 2,0,6*(b - (tiles - 1)/2.0) + 2.0*(i%3) - 2),
+										   Point(0,1,0), sizes[i]), m);
+		}
+
+		GLdouble half = 3.0*tiles;
+		world.add(Light(Point(half,-half,half),Color(1,1,1),4*half*half, 5));
+		world.add(Light(Point(-half,-half,-half),Color(1,1,1),2*half*half, 3));
+
+		return new Camera(Point(0,0,0),Point(half,-2*half,half),Point(0,1,0),1,8*half,40,0.3);
+	}
+
+	//a scene file: one record per line, a keyword and its numbers, points
+	//and colors taking three. Objects get the last material given before
+	//them, or "material 0.4 0.5 0 100 0.1 1 1 1" before the first one. Mesh
+	//paths are relative to the file and # starts a comment.
+	//
+	//  size <width> <height>
+	//  quality <antialias> <depth> <shadows> <interreflections>
+	//  camera <at> <from> <up> <near> <far> <fovy> <lens>
+	//  ambient <intensity>
+	//  light <position> <color> <intensity> <radius>
+	//  material <diffuse> <specular> <reflection> <shininess> <ambient> <color>
+	//  sphere <center> <radius>
+	//  cube <center> <side>
+	//  mesh <path.obj>
+	//
+	//Text is parsed a line at a time. write() saves the records as they are
+	//in memory, after a small header, and read() takes either form.
+	struct SceneFile
+	{
+		enum Kind { SIZE, QUALITY, CAMERA, AMBIENT, LIGHT, MATERIAL, SPHERE, CUBE, MESH, KINDS };
+		static const GLuint VALUES = 13;
+
+		//a mesh keeps its path's offset in strings as values[0]
+		struct Record
+		{
+			GLuint kind, count;
+			GLdouble values[VALUES];
+		};
+
+		std::vector<Record> records;
+		std::vector<char> strings;
+		std::vector<char> directory; //of the file read, with its slash
+
+		//what the records set besides the world, defaults otherwise
+		GLint width, height;
+		GLuint quality[4];
+
+		SceneFile():width(320),height(240)
+		{
+			quality[0] = quality[1] = quality[2] = 1;
+			quality[3] = 0;
+		}
+
+		bool read(const char* path)
+		{
+			FILE* f = fopen(path, "rb");
+			if (!f) {
+				perror(path);
+				return false;
+			}
+			records.clear();
+			strings.clear();
+			const char* slash = strrchr(path, '/');
+			directory.assign(path, slash ? slash + 1 : path);
+
+			Header header;
+			bool ok = fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, "RTSCENE1", 8) ?
+				readCompiled(path, f, header) : (rewind(f), readText(path, f));
+			fclose(f);
+			if (ok)
+				settings();
+			return ok;
+		}
+
+		bool write(const char* path) const
+		{
+			FILE* f = fopen(path, "wb");
+			if (!f)
+				return false;
+			Header header = { { 'R','T','S','C','E','N','E','1' }, (GLuint)records.size(), (GLuint)strings.size() };
+			bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+					  (records.empty() || fwrite(&records[0], sizeof(Record), records.size(), f) == records.size()) &&
+					  (strings.empty() || fwrite(&strings[0], 1, strings.size(), f) == strings.size());
+			return fclose(f) == 0 && ok;
+		}
+
+		//adds the lights and objects to world, 0 if a mesh can't be loaded.
+		//Without a camera record the view is the demo's. With cache, OBJ
+		//meshes are cached next to their file (see TriangleMesh::load).
+		Camera* build(World& world, bool cache = false) const
+		{
+			//the format's default, which rc's loadScene shares
+			Material material(0.4,0.5,0,100,0.1,Color(1,1,1));
+			Camera* ret = new Camera(Point(0,0,0),Point(10,-20,10),Point(0,1,0),30,3000,7,0.3);
+			for (GLuint r = 0; r < records.size(); r++) {
+				GLdouble const* v = records[r].values;
+				switch (records[r].kind) {
+					case CAMERA:
+						*ret = Camera(Point(v[0],v[1],v[2]),Point(v[3],v[4],v[5]),Point(v[6],v[7],v[8]),v[9],v[10],v[11],v[12]);
+						break;
+					case AMBIENT:
+						world.ambientIntensity = v[0];
+						break;
+					case LIGHT:
+						world.add(Light(Point(v[0],v[1],v[2]),Color(v[3],v[4],v[5]),v[6],v[7]));
+						break;
+					case MATERIAL:
+						material = Material(v[0],v[1],v[2],v[3],v[4],Color(v[5],v[6],v[7]));
+						break;
+					case SPHERE:
+						world.add(new Sphere(Point(v[0],v[1],v[2]),Point(0,1,0),v[3]), material);
+						break;
+					case CUBE:
+						world.add(new Cube(Point(v[0],v[1],v[2]),Point(0,1,0),v[3]), material);
+						break;
+					case MESH: {
+						std::vector<char> path(directory);
+						const char* name = &strings[(GLuint)v[0]];
+						if (name[0] == '/')
+							path.clear();
+						path.insert(path.end(), name, name + strlen(name) + 1);
+						TriangleMesh* mesh = TriangleMesh::load(&path[0], cache);
+						if (!mesh) {
+							fprintf(stderr, "%s: can't load mesh\n", &path[0]);
+							delete ret;
+							return 0;
+						}
+						world.add(mesh, material);
+						break;
+					}
+				}
+			}
+			return ret;
+		}
+
+		private:
+			struct Header
+			{
+				char magic[8];
+				GLuint records, strings;
+			};
+
+			static const char* keyword(GLuint kind)
+			{
+				static const char* names[KINDS] = { "size", "quality", "camera", "ambient", "light",
+													"material", "sphere", "cube", "mesh" };
+				return names[kind];
+			}
+			static GLuint arity(GLuint kind)
+			{
+				static const GLuint counts[KINDS] = { 2, 4, 13, 1, 8, 8, 4, 4, 0 };
+				return counts[kind];
+			}
+
+			bool readCompiled(const char* path, FILE* f, Header const& header)
+			{
+				records.resize(header.records);
+				strings.resize(header.strings);
+				if ((!records.empty() && fread(&records[0], sizeof(Record), records.size(), f) != records.size()) ||
+					(!strings.empty() && fread(&strings[0], 1, strings.size(), f) != strings.size())) {
+					fprintf(stderr, "%s: truncated\n", path);
+					return false;
+				}
+				if (!strings.empty() && strings.back() != 0) {
+					fprintf(stderr, "%s: bad strings\n", path);
+					return false;
+				}
+				for (GLuint r = 0; r < records.size(); r++)
+					if (records[r].kind >= KINDS ||
+						(records[r].kind == MESH && records[r].values[0] >= strings.size())) {
+						fprintf(stderr, "%s: bad record %u\n", path, r);
+						return false;
+					}
+				return true;
+			}
+
+			bool readText(const char* path, FILE* f)
+			{
+				char line[4096];
+				for (GLuint number = 1; fgets(line, sizeof(line), f); number++) {
+					if (!strchr(line, '\n') && !feof(f)) {
+						fprintf(stderr, "%s:%u: line too long\n", path, number);
+						return false;
+					}
+					char* p = strchr(line, '#');
+					if (p)
+						*p = 0;
+					p = line + strspn(line, " \t\r\n");
+					if (!*p)
+						continue;
+
+					size_t length = strcspn(p, " \t\r\n");
+					Record record = Record();
+					for (record.kind = 0; record.kind < KINDS; record.kind++)
+						if (strlen(keyword(record.kind)) == length && !strncmp(p, keyword(record.kind), length))
+							break;
+					if (record.kind == KINDS) {
+						fprintf(stderr, "%s:%u: unknown record %.*s\n", path, number, (int)length, p);
+						return false;
+					}
+					p += length;
+					p += strspn(p, " \t");
+
+					if (record.kind == MESH) {
+						length = strcspn(p, "\r\n");
+						while (length > 0 && (p[length-1] == ' ' || p[length-1] == '\t'))
+							length--;
+						if (length == 0) {
+							fprintf(stderr, "%s:%u: mesh without a path\n", path, number);
+							return false;
+						}
+						record.count = 1;
+						record.values[0] = strings.size();
+						strings.insert(strings.end(), p, p + length);
+						strings.push_back(0);
+					} else {
+						for (record.count = 0; record.count < VALUES; record.count++) {
+							char* end;
+							record.values[record.count] = strtod(p, &end);
+							if (end == p)
+								break;
+							p = end;
+						}
+						if (record.count != arity(record.kind) || p[strspn(p, " \t\r\n")]) {
+							fprintf(stderr, "%s:%u: %s takes %u numbers\n", path, number,
+									keyword(record.kind), arity(record.kind));
+							return false;
+						}
+					}
+					records.push_back(record);
+				}
+				return true;
+			}
+
+			void settings()
+			{
+				for (GLuint r = 0; r < records.size(); r++) {
+					GLdouble const* v = records[r].values;
+					if (records[r].kind == SIZE) {
+						width = v[0];
+						height = v[1];
+					} else if (records[r].kind == QUALITY)
+						for (GLuint k = 0; k < 4; k++)
+							quality[k] = v[k];
+				}
+			}
+	};
+}
+
+#endif
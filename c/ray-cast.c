@@ -1,57 +1,56 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
+#include <sys/time.h>
 #include "ray-cast.h"
 
 extern int debug;
 int WIDTH;
 int HEIGHT;
-const int N_SPHERES = 8;
-const int N_CUBES = 0;
+int N_LIGHTS = 2;
+int N_SPHERES = 8;
+int N_CUBES = 0;
 
 int changed = 3;
 
-Light myLights[2];
-Sphere mySphere[8];
-Cube myCube[1];
+Light *myLights;
+Sphere *mySphere;
+Cube *myCube;
 Camera myCamera;
 RayCaster rayzor;
 
-void plotPixel(GLdouble x, GLdouble y, Color c){
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-
-	glBegin(GL_QUADS);
-	glColor3d(c.red, c.green, c.blue);
-	glVertex2d(x, y);
-	glVertex2d(x, y+1);
-	glVertex2d(x+1, y+1);
-	glVertex2d(x+1, y);
-	glEnd();
-
-	return;
+GLdouble now() {
+	struct timeval t;
+	gettimeofday(&t, 0);
+	return t.tv_sec + t.tv_usec * 1e-6;
 }
 
 void rayCast () {
-	glMatrixMode(GL_MODELVIEW);
-	glClear (GL_COLOR_BUFFER_BIT);
+	GLdouble begin = now(), trace = 0;
 
 	if (changed) {
-		if (changed == 2)
-			deleteRayCaster(rayzor);
-		if (changed > 1)
+		if (changed == 3)
 			rayzor = newRayCaster(myCamera,5);
+		else if (changed == 2)
+			updateRayCaster(&rayzor, myCamera);
 
-		render(rayzor, myLights, 2, mySphere, N_SPHERES, myCube, N_CUBES);
+		render(rayzor, myLights, N_LIGHTS, mySphere, N_SPHERES, myCube, N_CUBES);
+		pack(rayzor);
 		changed = 0;
+		trace = now() - begin;
+		begin = now();
 	}
 
-	GLint i, j;
-	for (i = 0; i < rayzor.viewport[2]; i++)
-		for (j = 0; j < rayzor.viewport[3]; j++)
-			plotPixel(i, j, rayzor.buffer[i][j]);
-	
-	glFlush();
+	/* the whole frame in one upload, from the bottom left corner */
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glClear (GL_COLOR_BUFFER_BIT);
+	glRasterPos2i(0, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glDrawPixels(rayzor.viewport[2], rayzor.viewport[3], GL_RGB, GL_UNSIGNED_BYTE, rayzor.pixels);
+	glFinish();
+
+	printf("trace %fs display %fs\n", trace, now() - begin);
 }
 
 void reshape(int w, int h)
@@ -72,6 +71,10 @@ void keyboard (unsigned char key, int x, int y)
 	x=y=x;
 	changed = 1;	
 
+	/* the light keys move the first light, if there is one */
+	if (N_LIGHTS == 0 && strchr("tfghryvb", key))
+		return;
+
 	switch (key) {
 	  case 't':
 		 myLights[0].position.y -= taxa;
@@ -164,8 +167,8 @@ void keyboard (unsigned char key, int x, int y)
 
 	sprintf(buffer, "Camera (%f, %f, %f); Light(%f, %f, %f); Rate: %f",
 			myCamera.lookFrom.x, myCamera.lookFrom.y, myCamera.lookFrom.z,
-			myLights[0].position.x, myLights[0].position.y, myLights[0].position.z,
-			taxa);
+			N_LIGHTS ? myLights[0].position.x : 0, N_LIGHTS ? myLights[0].position.y : 0,
+			N_LIGHTS ? myLights[0].position.z : 0, taxa);
 
 	glutSetWindowTitle(buffer);
 }
@@ -187,6 +190,25 @@ void init (int argc, char** argv, GLint x, GLint y) {
 
 int main(int argc, char** argv)
 {
+	/* a scene file replaces the spheres below */
+	if (argc > 1) {
+		Scene scene;
+		if (!loadScene(argv[1], &scene))
+			return 1;
+		myCamera = scene.camera;
+		myLights = scene.lights;
+		mySphere = scene.spheres;
+		myCube = scene.cubes;
+		N_LIGHTS = scene.n_lights;
+		N_SPHERES = scene.n_spheres;
+		N_CUBES = scene.n_cubes;
+		init (argc, argv, scene.width, scene.height);
+		return 0;
+	}
+
+	myLights = malloc(2 * sizeof(Light));
+	mySphere = malloc(8 * sizeof(Sphere));
+	myCube = malloc(sizeof(Cube));
 	myCamera = newCamera(-30,-20,32, 0,0,0, 0,1,0, 1,300,10);
 	//myCamera = newCamera(-12,-25,30, 7,7,0, 0,-1,0, 1,1000,30);
 	/*myCamera = newCamera(20,20,0, 5,5,0, 0,1,0, 1,1000,30);
@@ -1,11 +1,14 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int debug = 0;
 const GLdouble RAYCASTER_PRECISION = 0.000000001;
 const GLdouble RAYCASTER_SUPERSAMPLING_X[] = { 0, -0.5, 0.5, 0.5, -0.5, 0, 0.5, 0, -0.5 };
 const GLdouble RAYCASTER_SUPERSAMPLING_Y[] = { 0, 0.5, 0.5, -0.5, -0.5, 0.5, 0, -0.5, 0 };
+/* light under this intensity/distance^2 is left out */
+const GLdouble RAYCASTER_LIGHT_THRESHOLD = 0.001;
 
 typedef struct {
 	GLdouble red;
@@ -51,13 +54,18 @@ void printC(Color a);
 
 typedef struct {
 	GLuint sampling;
-	GLdouble modelview[16], projection[16];
 	GLint viewport[4];
+	/* the far plane: a ray through pixel (x, y) ends at corner + x stepX + y stepY */
+	Point corner, stepX, stepY;
 
 	Point camera;
 	GLdouble far;
 
-	Color **buffer;
+	/* the picture as float RGB pixels row by row, and packed as RGB8 rows,
+	   bottom row first, for glDrawPixels. Both hold capacity pixels */
+	GLfloat *buffer;
+	GLubyte *pixels;
+	GLint capacity;
 } RayCaster;
 
 typedef struct {
@@ -81,8 +89,14 @@ typedef struct {
 	Point position;
 	Material material;
 	GLdouble side;
+
+	Point lower, upper;
 } Cube;
 
+/* outward normals of the cube faces: top, bottom, front, back, right, left */
+const Point CUBE_NORMALS[] = { { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 },
+							   { 0, 0, -1 }, { 1, 0, 0 }, { -1, 0, 0 } };
+
 typedef struct {
 	Point lookFrom;
 	Point lookAt;
@@ -97,13 +111,9 @@ typedef struct {
 	Point position;
 	Color color;
 	GLdouble intensity;
+	GLdouble reach; /* no further than its intensity, see newLight */
 } Light;
 
-struct intersection {
-	Point p, normal;
-	GLdouble len;
-};
-
 typedef struct {
 	Point p, normal;
 	GLdouble len;
@@ -151,6 +161,7 @@ Light newLight(GLdouble x, GLdouble y, GLdouble z,
 	ret.color.blue = b;
 
 	ret.intensity = i;
+	ret.reach = fmin(i, sqrt(i / RAYCASTER_LIGHT_THRESHOLD));
 
 	return ret;
 }
@@ -208,110 +219,105 @@ Cube newCube(GLdouble x, GLdouble y, GLdouble z,
 
 	ret.side = side;
 
+	ret.lower = point(x - side * 0.5, y - side * 0.5, z - side * 0.5);
+	ret.upper = point(x + side * 0.5, y + side * 0.5, z + side * 0.5);
+
 	return ret;
 }
 
-RayCaster newRayCaster(Camera c, GLuint sampling) {
-	GLdouble m[16], p[16];
-	glGetDoublev (GL_MODELVIEW_MATRIX, m);
-	glGetDoublev (GL_PROJECTION_MATRIX, p);
+/* 64 byte aligned memory, in place of the old block */
+void *reallocate(void *old, size_t size) {
+	void *ret = 0;
+	free(old);
+	if (posix_memalign(&ret, 64, size))
+		abort();
+	return ret;
+}
+
+/* follows the window and the camera, only reallocating the picture when
+   the window outgrows it */
+void updateRayCaster(RayCaster *r, Camera c) {
+	glGetIntegerv (GL_VIEWPORT, r->viewport);
+	if (r->viewport[2] * r->viewport[3] > r->capacity) {
+		r->capacity = r->viewport[2] * r->viewport[3];
+		r->buffer = reallocate(r->buffer, 3 * r->capacity * sizeof(GLfloat));
+		r->pixels = reallocate(r->pixels, 3 * r->capacity);
+	}
 
+	r->camera = c.lookFrom;
+	r->far = c.far;
+
+	/* the far plane gluLookAt and gluPerspective would unproject to, as a
+	   corner and a step per pixel */
+	Point forward = sub(c.lookAt, c.lookFrom);
+	forward = dv(forward, len(forward));
+	Point side = cross(forward, c.up);
+	side = dv(side, len(side));
+	Point up = cross(side, forward);
+	GLdouble height = c.far * tan(c.fovY / 2 * M_PI / 180);
+	GLdouble width = height * r->viewport[2] / r->viewport[3];
+
+	r->stepX = mul(2 * width / r->viewport[2], side);
+	r->stepY = mul(2 * height / r->viewport[3], up);
+	r->corner = add(c.lookFrom, mul(c.far, forward));
+	r->corner = sub(r->corner, add(mul(width, side), mul(height, up)));
+	r->corner = sub(r->corner, add(mul(r->viewport[0], r->stepX), mul(r->viewport[1], r->stepY)));
+}
+RayCaster newRayCaster(Camera c, GLuint sampling) {
 	RayCaster ret;
 	ret.sampling = sampling;
-	glGetIntegerv (GL_VIEWPORT, ret.viewport);
-	ret.buffer = malloc(ret.viewport[2] * sizeof(Color*));
-	int i = 0;
-	for (; i < ret.viewport[2]; i++)
-		ret.buffer[i] = malloc(ret.viewport[3] * sizeof(Color));
-
-	ret.camera = c.lookFrom;
-	ret.far = c.far;
-
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	gluLookAt(c.lookFrom.x, c.lookFrom.y, c.lookFrom.z,
-			  c.lookAt.x, c.lookAt.y, c.lookAt.z,
-			  c.up.x, c.up.y, c.up.z);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(c.fovY, (GLdouble) ret.viewport[2]/ret.viewport[3], c.near, c.far);
-	
-	glGetDoublev (GL_PROJECTION_MATRIX, ret.projection);
-	glGetDoublev (GL_MODELVIEW_MATRIX, ret.modelview);
-
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glMultMatrixd(m);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glMultMatrixd(p);
-
+	ret.buffer = 0;
+	ret.pixels = 0;
+	ret.capacity = 0;
+	updateRayCaster(&ret, c);
 	return ret;
 }
 void deleteRayCaster(RayCaster r) {
-	GLint i;
-	for (i = 0; i < r.viewport[2]; i++)
-		free(r.buffer[i]);
 	free(r.buffer);
+	free(r.pixels);
+}
+
+/* a color channel as an 8 bit value, clamped the way glColor3d does */
+GLubyte quantize(GLdouble c) {
+	return (GLubyte)(fmin(fmax(c, 0), 1) * 255 + 0.5);
+}
+void pack(RayCaster rayCaster) {
+	GLint i, n = 3 * rayCaster.viewport[2] * rayCaster.viewport[3];
+	for (i = 0; i < n; i++)
+		rayCaster.pixels[i] = quantize(rayCaster.buffer[i]);
 }
 
 Line getRay(RayCaster caster, GLdouble x, GLdouble y) {
-	static Line ret;
-	static GLdouble dY;
-	dY = (GLdouble)caster.viewport[3] - y - 1;
+	Line ret;
+	GLdouble dY = (GLdouble)caster.viewport[3] - y - 1;
 	ret.origin = caster.camera;
-	//gluUnProject (x, dY, 0.0, caster.modelview, caster.projection, caster.viewport, &ret.origin.x, &ret.origin.y, &ret.origin.z);
-	gluUnProject (x, dY, 1, caster.modelview, caster.projection, caster.viewport, &ret.destiny.x, &ret.destiny.y, &ret.destiny.z);
+	ret.destiny = add(caster.corner, add(mul(x, caster.stepX), mul(dY, caster.stepY)));
 	return ret;
 }
 
-struct intersection intersectSphere(Point l, Point origin, Sphere object) {
+/* how far along l the sphere is hit, or -1, and in root where: the one of
+   the two points nearest to origin, as long as the further one is ahead.
+   Nothing else is needed to pick the closest hit. */
+GLdouble intersectSphere(Point l, Point origin, Sphere object, GLdouble* root) {
 	Point oc = sub(origin,object.position);
 	
 	GLdouble b = dot(l,oc);
 	GLdouble c = dot(oc,oc);
 
 	GLdouble delta = b*b - c + object.radius*object.radius;
-	struct intersection ret;
-	ret.len = -1;
-
-	if (fabs(delta) < RAYCASTER_PRECISION)
-		return ret;
-	else {
-		Point solutions[2];
-
-		GLdouble roots[2];
-		roots[0] = -b + sqrt(delta);
-		roots[1] = -b - sqrt(delta);
-
-		solutions[0] = add(origin, mul(roots[0],l));
-		solutions[1] = add(origin, mul(roots[1],l));
-
-		GLdouble lengths[2];
-		lengths[0] = len2p(origin, solutions[0]);
-		lengths[1] = len2p(origin, solutions[1]);
-
-		GLubyte index = 0;
-
-		if (roots[0] < RAYCASTER_PRECISION)
-			if (roots[1] < RAYCASTER_PRECISION)
-				return ret;
-			else
-				index = 1;
-		else
-			index = 0;
-
 
-		if (lengths[1] < lengths[0])
-			index = 1;
+	if (delta < RAYCASTER_PRECISION)
+		return -1;
 
-		ret.p = solutions[index];
-		ret.len = lengths[index];
+	GLdouble s = sqrt(delta);
+	GLdouble far = -b + s, near = -b - s;
+	if (far < RAYCASTER_PRECISION)
+		return -1;
 
-		return ret;
-	}
+	/* l is unitary, so the roots tell which point is nearer; only that one
+	   is measured, the same way as before, so hits onto origin come out 0 */
+	*root = fabs(near) < far ? near : far;
+	return len2p(origin, add(origin, mul(*root, l)));
 }
 Intersection intersectAllSpheres(Line ray, GLdouble strength, Sphere objects[], GLint n_objects) {
 	Intersection intersected;
@@ -321,87 +327,73 @@ Intersection intersectAllSpheres(Line ray, GLdouble strength, Sphere objects[],
 
 	if (n_objects > 0) {
 		Point l = direction(ray);
-		GLdouble distance = strength;
-
-		struct intersection test;
-		test.len = -1;
+		GLdouble distance = strength, root = 0, test, closest = 0;
 		
-		GLint final = -1, k;
+		GLint k;
 		for (k = 0; k < n_objects; ++k) {
-			test = intersectSphere(l, ray.origin, objects[k]);
-			if (test.len > 0)
-				if (test.len < distance) {
-					distance = test.len;
-					intersected.len = test.len;
-					intersected.p = test.p;
-					final = k;
+			test = intersectSphere(l, ray.origin, objects[k], &root);
+			if (test > 0)
+				if (test < distance) {
+					distance = test;
+					closest = root;
+					intersected.i = k;
 				}
 		}
 
-		intersected.i = final;
+		/* only the closest one gets its point */
+		if (intersected.i >= 0) {
+			intersected.len = distance;
+			intersected.p = add(ray.origin, mul(closest, l));
+		}
 	}
 
 	return intersected;
 }
 
-void intersectPlane(GLdouble half, Point center, Point pivot, Point a, Point b, Point origin, Point l, struct intersection* ret) {
-	Point n = cross(direction(line(pivot,a)),direction(line(pivot,b)));
-	GLdouble denominator = dot(l,n);
-	if (denominator != 0) {
-		GLdouble numerator = dot(sub(pivot,origin), n);
-		numerator /= denominator;
-		
-		if (numerator < RAYCASTER_PRECISION)
-			return;
-
-		Point p = add(origin, mul(numerator, l));
-		Point q = sub(p, center);
+/* clips [near,far] against the slab of one axis, remembering the face that bounds each end */
+GLint clipSlab(GLdouble origin, GLdouble l, GLdouble lower, GLdouble upper, GLint face,
+			   GLdouble* near, GLdouble* far, GLint* nearFace, GLint* farFace) {
+	if (l == 0)
+		return origin >= lower && origin <= upper;
+
+	GLdouble t0 = (lower - origin) / l;
+	GLdouble t1 = (upper - origin) / l;
+	GLint f0 = face + 1, f1 = face;
+	if (l < 0) {
+		GLdouble t = t0; t0 = t1; t1 = t;
+		f0 = face; f1 = face + 1;
+	}
 
-		GLdouble x = fabs(q.x)-half;
-		GLdouble y = fabs(q.y)-half;
-		GLdouble z = fabs(q.z)-half;
-		
-		if (x > RAYCASTER_PRECISION || y > RAYCASTER_PRECISION || z > RAYCASTER_PRECISION)
-			return;
-
-		GLdouble len = len2p(p, origin);
-		if (ret->len == -1 || len - ret->len < 0) {
-			ret->p = p;
-			ret->normal = n;
-			ret->len = len;
-		}
+	if (t0 > *near) {
+		*near = t0;
+		*nearFace = f0;
+	}
+	if (t1 < *far) {
+		*far = t1;
+		*farFace = f1;
 	}
+	return *near <= *far;
 }
-struct intersection intersectCube(Point l, Point origin, Cube object) {
-	GLdouble half = object.side * 0.5;
-
-	Point a, b, c, d, e, f, g, h;
-	a = add(object.position, point(half, half, -half));
-	b = add(object.position, point(half, half, half));
-	c = add(object.position, point(-half, half, -half));
-	d = add(object.position, point(-half, half, half));
-	e = add(object.position, point(-half, -half, half));
-	f = add(object.position, point(half, -half, half));
-	g = add(object.position, point(half, -half, -half));
-	h = add(object.position, point(-half, -half, -half));
-
-	struct intersection ret;
-	ret.len = -1;
-	
-	//TOP
-	intersectPlane(half, object.position, d,b,c, origin,l, &ret);
-	//BOTTOM
-	intersectPlane(half, object.position, g,f,h, origin,l, &ret);
-	//FRONT
-	intersectPlane(half, object.position, b,d,f, origin,l, &ret);
-	//BACK
-	intersectPlane(half, object.position, h,c,g, origin,l, &ret);
-	//RIGHT
-	intersectPlane(half, object.position, a,b,g, origin,l, &ret);
-	//LEFT
-	intersectPlane(half, object.position, e,d,h, origin,l, &ret);
-	
-	return ret;
+/* how far along l the cube is hit, or -1, and through which face */
+GLdouble intersectCube(Point l, Point origin, Cube object, GLint* face) {
+	GLdouble near = -HUGE_VAL, far = HUGE_VAL;
+	GLint farFace = 0;
+	*face = 0;
+
+	/* same axis order as the old per-face tests, so edge ties pick the same face */
+	if (!clipSlab(origin.y, l.y, object.lower.y, object.upper.y, 0, &near, &far, face, &farFace) ||
+		!clipSlab(origin.z, l.z, object.lower.z, object.upper.z, 2, &near, &far, face, &farFace) ||
+		!clipSlab(origin.x, l.x, object.lower.x, object.upper.x, 4, &near, &far, face, &farFace))
+		return -1;
+
+	/* rays starting inside the cube leave through the far face */
+	if (near < RAYCASTER_PRECISION) {
+		if (far < RAYCASTER_PRECISION)
+			return -1;
+		*face = farFace;
+		return far;
+	}
+	return near;
 }
 Intersection intersectAllCubes(Line ray, GLdouble strength, Cube objects[], GLint n_objects) {
 	Intersection intersected;
@@ -411,23 +403,25 @@ Intersection intersectAllCubes(Line ray, GLdouble strength, Cube objects[], GLin
 
 	if (n_objects > 0) {
 		Point l = direction(ray);
-		GLdouble distance = strength;
-
-		struct intersection test;
-		test.len = -1;
+		GLdouble distance = strength, test;
+		GLint k, face = 0, closest = 0;
 		
-		GLint k;
 		for (k = 0; k < n_objects; ++k) {
-			test = intersectCube(l, ray.origin, objects[k]);
-			if (test.len > 0)
-				if (test.len < distance) {
-					distance = test.len;
-					intersected.len = test.len;
-					intersected.normal = test.normal;
-					intersected.p = test.p;
+			test = intersectCube(l, ray.origin, objects[k], &face);
+			if (test > 0)
+				if (test < distance) {
+					distance = test;
+					closest = face;
 					intersected.i = k;
 				}
 		}
+
+		/* only the closest one gets its point and normal */
+		if (intersected.i >= 0) {
+			intersected.len = distance;
+			intersected.p = add(ray.origin, mul(distance, l));
+			intersected.normal = CUBE_NORMALS[closest];
+		}
 	}
 
 	return intersected;
@@ -446,6 +440,30 @@ Intersection intersect(Line ray, GLdouble strength, Sphere spheres[], GLint n_sp
 		return cube;
 	return sphere;
 }
+/* whether anything but the object (type, index) lies between origin and
+   target, stopping at the first blocker */
+GLint occluded(Point origin, Point target, GLint type, GLint index,
+			   Sphere spheres[], GLint n_spheres, Cube cubes[], GLint n_cubes) {
+	Point l = sub(target, origin);
+	GLdouble distance = len(l) - RAYCASTER_PRECISION;
+	l = dv(l, len(l));
+
+	GLint k, face;
+	GLdouble test, root;
+	for (k = 0; k < n_spheres; ++k)
+		if (type != 0 || k != index) {
+			test = intersectSphere(l, origin, spheres[k], &root);
+			if (test > 0 && test < distance)
+				return 1;
+		}
+	for (k = 0; k < n_cubes; ++k)
+		if (type != 1 || k != index) {
+			test = intersectCube(l, origin, cubes[k], &face);
+			if (test > 0 && test < distance)
+				return 1;
+		}
+	return 0;
+}
 Color shade(Line ray, Intersection result, Light sources[], GLint n_sources, Sphere spheres[], GLint n_spheres, Cube cubes[], GLint n_cubes, GLdouble strength) {
 	Point normal = result.type ? result.normal : dv(sub(result.p, spheres[result.i].position), spheres[result.i].radius);
 	GLdouble originLen = len(ray.origin);
@@ -482,19 +500,22 @@ Color shade(Line ray, Intersection result, Light sources[], GLint n_sources, Sph
 		GLdouble str;
 		Color tmp = black;
 
+		/* lights out of reach are dropped before anything else */
 		Point light = sub(sources[i].position, result.p);
-		Line shadow = line(sources[i].position, result.p);
-
-		Intersection isShadow = intersect(shadow, sources[i].intensity, spheres, n_spheres, cubes, n_cubes);
-		
-		if (eq(isShadow.p,result.p))
+		if (dot(light, light) >= sources[i].reach * sources[i].reach)
+			continue;
+		GLdouble lightL = len(light);
+		light = dv(light, lightL);
+		GLdouble NL = dot(normal, light);
+
+		/* facing away from the light (and so shadowed by its own object)
+		   or behind something else */
+		if (NL > 0 &&
+			!occluded(sources[i].position, result.p, result.type, result.i,
+					  spheres, n_spheres, cubes, n_cubes))
 		{
-			GLdouble lightL = len(light);
 			GLdouble iLight = sources[i].intensity / (lightL * lightL);
 
-			light = dv(light, lightL);
-
-			GLdouble NL = dot(normal, light);
 			Point reflectedLight = sub(mul(2*NL,normal),light);
 			GLdouble phi = dot(reflectedLight, ray.origin)/(len(reflectedLight)*originLen);
 
@@ -529,9 +550,9 @@ void render(RayCaster rayCaster, Light sources[], GLint n_sources, Sphere sphere
 	GLdouble compensation = rayCaster.sampling;
 	compensation = 1/compensation;
 
-	for (i = 0; i < rayCaster.viewport[2]; i++)
-		for (j = 0; j < rayCaster.viewport[3]; j++) {
-			rayCaster.buffer[i][j] = black;
+	for (j = 0; j < rayCaster.viewport[3]; j++)
+		for (i = 0; i < rayCaster.viewport[2]; i++) {
+			Color color = black;
 			for (k = 0; k < rayCaster.sampling; k++) {
 				Line ray = getRay(rayCaster, i + RAYCASTER_SUPERSAMPLING_X[k], j + RAYCASTER_SUPERSAMPLING_Y[k]);
 
@@ -540,15 +561,20 @@ void render(RayCaster rayCaster, Light sources[], GLint n_sources, Sphere sphere
 					GLdouble rayL = lenL(ray);
 					GLdouble strength = rayL-intersected.len;
 					
-					rayCaster.buffer[i][j] = addC(rayCaster.buffer[i][j],shade(ray, intersected, sources, n_sources,
-												  spheres, n_spheres, cubes, n_cubes, strength));
+					color = addC(color,shade(ray, intersected, sources, n_sources,
+											 spheres, n_spheres, cubes, n_cubes, strength));
 				}
 
 				/*printf("%f%% ", 100*(i*rayCaster.viewport[3]+j)/total);
-				printC(rayCaster.buffer[i][j]);
+				printC(color);
 				printf("\n");*/
 			}
-			rayCaster.buffer[i][j] = muldC(compensation,rayCaster.buffer[i][j]);
+			color = muldC(compensation,color);
+
+			GLfloat *p = rayCaster.buffer + 3 * (j * rayCaster.viewport[2] + i);
+			p[0] = color.red;
+			p[1] = color.green;
+			p[2] = color.blue;
 		}
 
 
@@ -561,6 +587,157 @@ void render(RayCaster rayCaster, Light sources[], GLint n_sources, Sphere sphere
 }
 
 
+/* scene files, text or compiled by hrt -c (see SceneFile in c++/scene.hpp).
+   rc takes the size, camera, lights, materials, spheres and cubes, and
+   skips what it has no use for: quality, ambient, lenses, light radii and
+   meshes */
+enum { SCENE_SIZE, SCENE_QUALITY, SCENE_CAMERA, SCENE_AMBIENT, SCENE_LIGHT,
+	   SCENE_MATERIAL, SCENE_SPHERE, SCENE_CUBE, SCENE_MESH, SCENE_KINDS };
+const char *SCENE_KEYWORDS[] = { "size", "quality", "camera", "ambient", "light",
+								 "material", "sphere", "cube", "mesh" };
+const GLuint SCENE_ARITY[] = { 2, 4, 13, 1, 8, 8, 4, 4, 0 };
+
+typedef struct {
+	GLuint kind, count;
+	GLdouble values[13];
+} SceneRecord;
+
+typedef struct {
+	GLint width, height;
+	Camera camera;
+	Light *lights;
+	Sphere *spheres;
+	Cube *cubes;
+	GLint n_lights, n_spheres, n_cubes;
+} Scene;
+
+/* the records of a text scene, parsed a line at a time; -1 on errors */
+GLint readScene(const char *path, FILE *f, SceneRecord **records) {
+	char line[4096];
+	GLint n = 0;
+	GLuint number;
+
+	for (number = 1; fgets(line, sizeof(line), f); number++) {
+		SceneRecord r;
+		char *p = strchr(line, '#');
+		size_t length;
+
+		if (!strchr(line, '\n') && !feof(f)) {
+			fprintf(stderr, "%s:%u: line too long\n", path, number);
+			return -1;
+		}
+		if (p)
+			*p = 0;
+		p = line + strspn(line, " \t\r\n");
+		if (!*p)
+			continue;
+
+		length = strcspn(p, " \t\r\n");
+		for (r.kind = 0; r.kind < SCENE_KINDS; r.kind++)
+			if (strlen(SCENE_KEYWORDS[r.kind]) == length && !strncmp(p, SCENE_KEYWORDS[r.kind], length))
+				break;
+		if (r.kind == SCENE_KINDS) {
+			fprintf(stderr, "%s:%u: unknown record %.*s\n", path, number, (int)length, p);
+			return -1;
+		}
+		if (r.kind == SCENE_MESH)
+			continue;
+		p += length;
+
+		for (r.count = 0; r.count < 13; r.count++) {
+			char *end;
+			r.values[r.count] = strtod(p, &end);
+			if (end == p)
+				break;
+			p = end;
+		}
+		if (r.count != SCENE_ARITY[r.kind] || p[strspn(p, " \t\r\n")]) {
+			fprintf(stderr, "%s:%u: %s takes %u numbers\n", path, number,
+					SCENE_KEYWORDS[r.kind], SCENE_ARITY[r.kind]);
+			return -1;
+		}
+
+		*records = realloc(*records, (n + 1) * sizeof(SceneRecord));
+		(*records)[n++] = r;
+	}
+	return n;
+}
+
+/* the scene in path, or 0 if it can't be read. Without a camera the view
+   is the one rc starts with; objects before any material get the format's
+   default one, as in hrt */
+GLint loadScene(const char *path, Scene *scene) {
+	SceneRecord *records = 0;
+	GLint n = -1, i;
+	struct { char magic[8]; GLuint records, strings; } header;
+	Material m = { 0, 0.5, 100, 0.4, 0.1, { 1, 1, 1 } };
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		perror(path);
+		return 0;
+	}
+	if (fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, "RTSCENE1", 8)) {
+		records = malloc(header.records * sizeof(SceneRecord) + 1);
+		if (fread(records, sizeof(SceneRecord), header.records, f) == header.records)
+			n = header.records;
+		else
+			fprintf(stderr, "%s: truncated\n", path);
+	} else {
+		rewind(f);
+		n = readScene(path, f, &records);
+	}
+	fclose(f);
+	if (n < 0) {
+		free(records);
+		return 0;
+	}
+
+	scene->width = 100;
+	scene->height = 100;
+	scene->camera = newCamera(-30,-20,32, 0,0,0, 0,1,0, 1,300,10);
+	scene->lights = malloc(n * sizeof(Light) + 1);
+	scene->spheres = malloc(n * sizeof(Sphere) + 1);
+	scene->cubes = malloc(n * sizeof(Cube) + 1);
+	scene->n_lights = scene->n_spheres = scene->n_cubes = 0;
+
+	for (i = 0; i < n; i++) {
+		GLdouble *v = records[i].values;
+		switch (records[i].kind) {
+			case SCENE_SIZE:
+				scene->width = v[0];
+				scene->height = v[1];
+				break;
+			case SCENE_CAMERA:
+				scene->camera = newCamera(v[3],v[4],v[5], v[0],v[1],v[2], v[6],v[7],v[8], v[9],v[10],v[11]);
+				break;
+			case SCENE_LIGHT:
+				scene->lights[scene->n_lights++] = newLight(v[0],v[1],v[2], v[3],v[4],v[5], v[6]);
+				break;
+			case SCENE_MATERIAL:
+				m.diffuse = v[0];
+				m.specular = v[1];
+				m.reflection = v[2];
+				m.shiny = v[3];
+				m.ambient = v[4];
+				m.color.red = v[5];
+				m.color.green = v[6];
+				m.color.blue = v[7];
+				break;
+			case SCENE_SPHERE:
+				scene->spheres[scene->n_spheres++] = newSphere(v[0],v[1],v[2], m.reflection,
+					m.specular,m.shiny,m.diffuse,m.ambient, m.color.red,m.color.green,m.color.blue, v[3]);
+				break;
+			case SCENE_CUBE:
+				scene->cubes[scene->n_cubes++] = newCube(v[0],v[1],v[2], m.reflection,
+					m.specular,m.shiny,m.diffuse,m.ambient, m.color.red,m.color.green,m.color.blue, v[3]);
+				break;
+		}
+	}
+	free(records);
+	return 1;
+}
+
 Point point(GLdouble x, GLdouble y, GLdouble z) {
 	Point r;
 	r.x = x;